@@ -191,6 +191,8 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_NAP
   CcehNapIndex raw_index(proot->cons.get());
   nap::Nap<CcehNapIndex> cceh_nap(&raw_index);
+  // warmers read the raw index on their own thread ids
+  cceh_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
   // warm up
@@ -270,6 +270,8 @@ int main(int argc, char *argv[]) {
 #else
   nap::Nap<nap::MockIndex> clevel_nap(&raw_index);
 #endif
+  // warmers read the raw index on their own thread ids
+  clevel_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
   // warm up
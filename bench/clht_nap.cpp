@@ -259,6 +259,8 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_NAP
   ClhtNapIndex raw_index(proot->cons.get());
   nap::Nap<ClhtNapIndex> clht_nap(&raw_index, hot_cnt);
+  // warmers read the raw index on their own thread ids
+  clht_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
   // warm up
@@ -182,6 +182,8 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_NAP
   FastFairTreeIndex raw_index(tree);
   nap::Nap<FastFairTreeIndex> fastfair_nap(&raw_index);
+  // warmers read the raw index on their own thread ids
+  fastfair_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
   // warm up
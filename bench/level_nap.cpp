@@ -255,6 +255,8 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_NAP
   LevelNapIndex raw_index(proot->cons.get());
   nap::Nap<LevelNapIndex> level_nap(&raw_index);
+  // warmers read the raw index on their own thread ids
+  level_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
   // warm up
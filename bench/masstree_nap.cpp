@@ -177,6 +177,8 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_NAP
   MassTreeIndex raw_index(tree);
   nap::Nap<MassTreeIndex> masstree_nap(&raw_index);
+  // warmers read the raw index on their own thread ids
+  masstree_nap.set_thread_init([](int id) { my_thread_id = id; });
 #endif
 
 #ifdef SWITCH_TEST
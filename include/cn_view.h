@@ -1,11 +1,13 @@
 #if !defined(_CN_VIEW_H_)
 #define _CN_VIEW_H_
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "hybrid_clock.h"
 #include "nap_common.h"
 #include "rw_lock.h"
 #include "slice.h"
@@ -17,12 +19,55 @@ class CNView {
   friend class NapMeta;
 
 public:
-  struct Entry {
+  // per-node flat combining of the puts to a hot entry, see Nap::combine_put
+  struct alignas(kCachelineSize) CombineSlot {
+    std::atomic<bool> busy; // guards ``announced`` and ``value``
+    uint64_t announced;     // ticket of the newest announced put
+    std::string value;      // of that put
+    std::atomic<uint64_t> done; // puts up to this ticket are applied
+
+    CombineSlot() : busy(false), announced(0), done(0) {}
+
+    uint64_t announce(const Slice &v) {
+      lock();
+      uint64_t ticket = ++announced;
+      value.assign(v.data(), v.size());
+      unlock();
+      return ticket;
+    }
+
+    // the newest announced value into ``v``, and its ticket; under the
+    // entry lock
+    uint64_t take(std::string &v) {
+      lock();
+      uint64_t ticket = announced;
+      v.swap(value);
+      unlock();
+      return ticket;
+    }
+
+  private:
+    void lock() {
+      while (busy.exchange(true, std::memory_order_acquire)) {
+        __builtin_ia32_pause();
+      }
+    }
+
+    void unlock() { busy.store(false, std::memory_order_release); }
+  };
+
+  // padded, so that the locks of neighbouring hot entries never share a line
+  struct alignas(kCachelineSize) Entry {
 
     WRLock l; // control concurrent accesses to the NAL
     bool is_deleted;
     bool shifting;
+    bool dirty; // updated since the last checkpoint
+    bool read_only; // read-hot only: a DRAM read cache without PC-View slot
+    bool commit_pending; // queued for a group commit, see group_commit.h
     int sp_view_index;
+    uint64_t pending_ver; // the version the group commit persists
+    CombineSlot *combine; // per node, for the hottest write keys, or nullptr
 
 
     // used for 3-phase switch for lazy initialization
@@ -31,34 +76,126 @@ public:
     // serve lookup operation
     std::string v;
     
-#ifndef GLOBAL_VERSION
-    uint64_t version; // for recoverability
-#endif
+    uint64_t version; // of the latest write, for recoverability
 
     Entry()
-        : is_deleted(false), shifting(false), sp_view_index(0),
-          location(WhereIsData::IN_RAW_INDEX) {
-#ifndef GLOBAL_VERSION
-      version = 0;
-#endif
-    }
+        : is_deleted(false), shifting(false), dirty(false), read_only(false),
+          commit_pending(false), sp_view_index(0), pending_ver(0),
+          combine(nullptr), location(WhereIsData::IN_RAW_INDEX), version(0) {}
 
-#ifndef GLOBAL_VERSION
+    // called under the entry lock
+#ifdef GLOBAL_VERSION
+    uint64_t next_version() { return version = HybridClock::next(version); }
+#else
     uint64_t next_version() { return version++; }
 #endif
   };
 
-  CNView() {}
+#ifdef SUPPORT_RANGE
+  using Map = std::map<std::string, Entry>;
+#else
+  using Map = std::unordered_map<std::string, Entry>;
+#endif
+  using Cursor = Map::iterator;
+
+  // the entries of a deleted view, with their keys, for the next view to
+  // reuse instead of allocating a node per hot key
+  struct Arena {
+    std::vector<Map::node_type> nodes;
+  };
+
+  CNView() : arena(nullptr) {}
 
-  CNView(const std::vector<std::pair<std::string, WhereIsData>> &list) {
+  // keys of ``list`` own the PC-View slot of their position; keys of
+  // ``read_list`` are served from DRAM only.
+  CNView(const std::vector<std::pair<std::string, WhereIsData>> &list,
+         const std::vector<std::pair<std::string, WhereIsData>> &read_list,
+         Arena *arena = nullptr)
+      : arena(arena) {
     for (size_t i = 0; i < list.size(); ++i) {
       Entry e;
       e.sp_view_index = i;
       e.location = list[i].second;
-      view[list[i].first] = std::move(e);
+      add(list[i].first) = std::move(e);
+    }
+
+    for (size_t i = 0; i < read_list.size(); ++i) {
+      Entry e;
+      e.read_only = true;
+      e.sp_view_index = -1;
+      e.location = read_list[i].second;
+      add(read_list[i].first) = std::move(e);
+    }
+
+    index_to_entry.resize(list.size());
+    for (auto &e : view) {
+      if (!e.second.read_only) {
+        index_to_entry[e.second.sp_view_index] = &e.second;
+      }
     }
   }
 
+  ~CNView() {
+    for (auto &e : view) {
+      e.second.l.disable_node_readers();
+      delete[] e.second.combine;
+    }
+
+    if (arena) {
+      while (!view.empty()) {
+        arena->nodes.push_back(view.extract(view.begin()));
+      }
+    }
+  }
+
+  // ``keys`` are the hottest first; both before the view is published
+
+  // spread the readers of the first ``n`` keys over per-node counters
+  void enable_node_readers(const std::vector<std::string> &keys, size_t n) {
+    for (size_t i = 0; i < std::min(n, keys.size()); ++i) {
+      auto it = view.find(keys[i]);
+      if (it != view.end()) {
+        it->second.l.enable_node_readers();
+      }
+    }
+  }
+
+  // combine the puts to the first ``n`` keys per node
+  void enable_combining(const std::vector<std::string> &keys, size_t n) {
+    for (size_t i = 0; i < std::min(n, keys.size()); ++i) {
+      auto it = view.find(keys[i]);
+      if (it != view.end() && !it->second.read_only &&
+          it->second.combine == nullptr) {
+        it->second.combine = new CombineSlot[Topology::kNumaCnt];
+      }
+    }
+  }
+
+  // the ``n`` keys whose entry locks were contended most often
+  std::vector<std::pair<std::string, uint32_t>> contention(size_t n) {
+    std::vector<std::pair<std::string, uint32_t>> res;
+    for (auto &e : view) {
+      if (e.second.l.contention() > 0) {
+        res.push_back({e.first, e.second.l.contention()});
+      }
+    }
+
+    n = std::min(n, res.size());
+    std::partial_sort(res.begin(), res.begin() + n, res.end(),
+                      [](const std::pair<std::string, uint32_t> &a,
+                         const std::pair<std::string, uint32_t> &b) {
+                        return a.second > b.second;
+                      });
+    res.resize(n);
+    return res;
+  }
+
+  Entry *entry_at(size_t sp_view_index) {
+    return index_to_entry[sp_view_index];
+  }
+
+  bool contains(const std::string &key) { return view.count(key) > 0; }
+
   bool get_entry(const Slice &key, Entry *&entry) {
     auto ret = view.find(key.ToString());
     if (ret == view.end()) {
@@ -72,27 +209,49 @@ public:
 
   // finish lazy initialization
   void relocate_value(CNView *old_view) {
-    for (auto &e : view) {
+    relocate_value(old_view, view.begin(), SIZE_MAX);
+  }
+
+  // of ``batch`` entries from ``from`` on; returns where the next batch
+  // starts
+  Cursor relocate_value(CNView *old_view, Cursor from, size_t batch) {
+    for (; from != view.end() && batch > 0; ++from, --batch) {
+      auto &e = *from;
       if (e.second.location == WhereIsData::IN_PREVIOUS_EPOCH) {
         e.second.l.wLock();
         if (e.second.location == WhereIsData::IN_PREVIOUS_EPOCH) {
-          e.second.location = WhereIsData::IN_CURRENT_EPOCH;
           auto &old_e = old_view->view[e.first];
-          e.second.v = old_e.v;
-          e.second.is_deleted = old_e.is_deleted;
+          if (old_e.location == WhereIsData::IN_RAW_INDEX) {
+            // never loaded in the previous epoch, the raw index is up to date
+            e.second.location = WhereIsData::IN_RAW_INDEX;
+          } else {
+            e.second.location = WhereIsData::IN_CURRENT_EPOCH;
+            e.second.v = old_e.v;
+            e.second.is_deleted = old_e.is_deleted;
+          }
         }
         e.second.l.wUnlock();
       }
     }
+    return from;
   }
 
-#ifdef SUPPORT_RANGE
-  std::map<std::string, Entry> view;
-#else
-  std::unordered_map<std::string, Entry> view;
-#endif
+  Map view;
 
 private:
+  std::vector<Entry *> index_to_entry; // PC-View slot => entry
+  Arena *arena; // takes the entries back, or nullptr
+
+  Entry &add(const std::string &key) {
+    if (arena == nullptr || arena->nodes.empty()) {
+      return view[key];
+    }
+
+    auto node = std::move(arena->nodes.back());
+    arena->nodes.pop_back();
+    node.key() = key; // reuses the old key's buffer if it fits
+    return view.insert(std::move(node)).position->second;
+  }
 };
 
 } // namespace nap
@@ -3,12 +3,12 @@
 
 #include "hash32.h"
 #include "murmur_hash2.h"
+#include "murmur_hash3.h"
 #include "nap_common.h"
 #include "slice.h"
-#include "timer.h"
 #include "top_k.h"
-#include "topology.h"
 
+#include <algorithm>
 #include <functional>
 #include <queue>
 #include <set>
@@ -37,162 +37,140 @@ inline unsigned long __hash(const char *str, int size) {
 
 namespace nap {
 
-struct __attribute__((__packed__)) PerRecord {
-  uint64_t timestamp;
-  char *v;
-
-  PerRecord() : timestamp(0), v(nullptr) {}
-};
-
-struct RecordCursor {
-  uint64_t last_ts;
-  uint32_t last_index;
-
-  RecordCursor() : last_ts(0), last_index(0) {}
-};
-
-static_assert(sizeof(PerRecord) == 16, "XX");
-
-class CountMin {
+// Count-min sketch with 16-bit saturating counters, conservative update and
+// lazy aging.
+class CountMinSketch {
 private:
-  int hot_keys_cnt;
+  using Counter = uint16_t;
+  constexpr static Counter kCounterMax = 0xffff;
 
   const static int kHashCnt = 3;
-  const static int kBloomLength = 876199;
-  uint32_t *bloom_array[kHashCnt];
-  uint64_t hash_seed[32] = {931901, 1974701, 7296907};
-
-  TopK topK;
-
-  const uint32_t kRecordBufferSize = 20000;
-  PerRecord *record_buffer[kMaxThreadCnt];
-  RecordCursor cursors[kMaxThreadCnt];
-
-public:
-  CountMin(int hot_keys_cnt) : hot_keys_cnt(hot_keys_cnt), topK(hot_keys_cnt) {
+  const uint64_t kBloomLength; // a power of 2
+  Counter *bloom_array[kHashCnt];
+
+  // aging by halving, applied lazily: each block of counters remembers the
+  // age it was last brought up to, so ``decay`` never touches the rows.
+  constexpr static int kAgeBlock = 64;
+  const uint64_t kAgeBlockCnt;
+  uint32_t *age_array[kHashCnt];
+  uint32_t cur_age;
+
+  void hash(const Slice &key, uint64_t *hash_val) {
+    // derive all row indices from one 128-bit hash (double hashing)
+    uint64_t h[2];
+    MurmurHash3_x64_128(key.data(), key.size(), h);
     for (int i = 0; i < kHashCnt; ++i) {
-      bloom_array[i] = new uint32_t[kBloomLength];
-      memset(bloom_array[i], 0, kBloomLength * sizeof(uint32_t));
+      hash_val[i] = (h[0] + i * h[1]) & (kBloomLength - 1);
+      age_block(i, hash_val[i] / kAgeBlock);
+    }
+  }
+
+  void age_block(int row, int block) {
+    uint32_t diff = cur_age - age_array[row][block];
+    if (diff == 0) {
+      return;
     }
 
-    for (int i = 0; i < kMaxThreadCnt; ++i) {
-      record_buffer[i] = new PerRecord[kRecordBufferSize];
+    auto *counter = bloom_array[row] + block * kAgeBlock;
+    for (int k = 0; k < kAgeBlock; ++k) {
+      counter[k] = diff >= 16 ? 0 : counter[k] >> diff;
     }
+    age_array[row][block] = cur_age;
   }
 
-  ~CountMin() {
+public:
+  CountMinSketch(int length_shift)
+      : kBloomLength(1ull << length_shift),
+        kAgeBlockCnt(kBloomLength / kAgeBlock), cur_age(0) {
     for (int i = 0; i < kHashCnt; ++i) {
-      if (bloom_array[i]) {
-        delete[] bloom_array[i];
-      }
+      bloom_array[i] = new Counter[kBloomLength];
+      age_array[i] = new uint32_t[kAgeBlockCnt];
     }
+    reset();
+  }
 
-    for (int i = 0; i < kMaxThreadCnt; ++i) {
-      if (record_buffer[i]) {
-        delete[] record_buffer[i];
-      }
+  ~CountMinSketch() {
+    for (int i = 0; i < kHashCnt; ++i) {
+      delete[] bloom_array[i];
+      delete[] age_array[i];
     }
   }
 
-  std::vector<Node> &get_list() { return topK.get_list(); }
+  // halve all counters
+  void decay() { cur_age++; }
 
   void reset() {
-    topK.reset();
     for (int i = 0; i < kHashCnt; ++i) {
-      memset(bloom_array[i], 0, kBloomLength * sizeof(uint32_t));
+      memset(bloom_array[i], 0, kBloomLength * sizeof(Counter));
+      memset(age_array[i], 0, kAgeBlockCnt * sizeof(uint32_t));
     }
+    cur_age = 0;
   }
 
-  void record(const Slice &key) {
-
-    // for threads that access keys.
-    static thread_local int index = 0;
-    static thread_local char *free_buffer = nullptr;
-    static thread_local PerRecord *thread_records =
-        record_buffer[Topology::threadID()];
+  // count one access of ``key``, return its new estimated frequency
+  int increment(const Slice &key) {
+    uint64_t hash_val[kHashCnt];
+    hash(key, hash_val);
 
-    char *buf;
-    if (free_buffer && *(uint32_t *)(free_buffer) >= key.size()) {
-      buf = free_buffer;
-      free_buffer = nullptr;
-    } else {
-      buf = (char *)malloc(key.size() + sizeof(uint32_t));
+    Counter min_freq = kCounterMax;
+    for (int i = 0; i < kHashCnt; ++i) {
+      min_freq = std::min(min_freq, bloom_array[i][hash_val[i]]);
     }
 
-    *(uint32_t *)buf = key.size();
-    memcpy(buf + sizeof(uint32_t), key.data(), key.size());
-
-    char *old_ptr = thread_records[index].v;
-    
-
-    // record access pattern (key, timestamp), it is coordination-free
-    thread_records[index].v = buf;
-    thread_records[index].timestamp = asm_rdtsc();
-
-    if (!old_ptr) {
-      if (!free_buffer) {
-        free_buffer = old_ptr;
-      } else if (*(uint32_t *)(free_buffer) < *(uint32_t *)(old_ptr)) {
-        free(free_buffer);
-        free_buffer = old_ptr;
+    // conservative update: only counters equal to the minimum grow
+    if (min_freq != kCounterMax) {
+      min_freq++;
+      for (int i = 0; i < kHashCnt; ++i) {
+        auto &c = bloom_array[i][hash_val[i]];
+        if (c < min_freq) {
+          c = min_freq;
+        }
       }
     }
 
-    index = (index + 1) % kRecordBufferSize;
+    return min_freq;
   }
 
-  void poll_workloads(double seconds) {
-
-    uint64_t ns = seconds * (1000ull * 1000 * 1000);
-    uint16_t kBatchPerThread = 8;
-    Timer timer;
-    timer.begin();
-
-    while (true) {
-      for (int i = 0; i < kMaxThreadCnt; ++i) {
-        for (int k = 0; k < kBatchPerThread; ++k) {
-          auto &c = cursors[i];
-          auto &r = record_buffer[i][c.last_index];
-          if (r.timestamp < c.last_ts ||
-              r.v == nullptr) {
-            break; // invalid record
-          }
-           
-
-          // update count-min sketch and min heap
-          this->access_a_key(Slice(r.v + sizeof(uint32_t), *(uint32_t *)r.v));
-
-          c.last_ts = r.timestamp;
-          c.last_index = (c.last_index + 1) % kRecordBufferSize;
-        }
+  int estimate(const Slice &key) {
+    uint64_t hash_val[kHashCnt];
+    hash(key, hash_val);
 
-        if (timer.end() > ns) {
-          return;
-        }
-      }
+    Counter min_freq = kCounterMax;
+    for (int i = 0; i < kHashCnt; ++i) {
+      min_freq = std::min(min_freq, bloom_array[i][hash_val[i]]);
     }
+    return min_freq;
   }
+};
 
-  void access_a_key(const Slice &key) {
+// Count-min sketch feeding a min heap of the hottest keys.  It only counts;
+// sampling is done by ``RecordRing``.
+class CountMin {
+private:
+  // 1 << 17 counters per row would fit L2, but lose recall for 100k hot keys
+  constexpr static int kBloomLengthShift = 20;
 
-    // static std::hash<std::string> hash_fn;
-    uint64_t hash_val[kHashCnt];
-    for (int i = 0; i < kHashCnt; ++i) {
-      hash_val[i] =
-          (MurmurHash64A(key.data(), key.size(), hash_seed[i])) % kBloomLength;
-    }
-    // hash_val[1] =__hash(key.c_str(), key.size()) % kBloomLength;
-    // hash_val[2] = xxhash(key.c_str(), key.size(), 333) % kBloomLength;
+  CountMinSketch sketch;
+  TopK topK;
 
-    uint64_t min_freq = ++bloom_array[0][hash_val[0]];
+public:
+  CountMin(int hot_keys_cnt) : sketch(kBloomLengthShift), topK(hot_keys_cnt) {}
 
-    for (int i = 1; i < kHashCnt; ++i) {
-      auto tmp = ++bloom_array[i][hash_val[i]];
-      if (tmp < min_freq) {
-        min_freq = tmp;
-      }
-    }
-    topK.access_a_key(key.ToString(), min_freq);
+  std::vector<Node> &get_list() { return topK.get_list(); }
+
+  // halve all frequencies, so history fades out instead of being dropped
+  void decay() {
+    topK.decay();
+    sketch.decay();
+  }
+
+  void reset() {
+    topK.reset();
+    sketch.reset();
+  }
+
+  void access_a_key(const Slice &key) {
+    topK.access_a_key(key.ToString(), sketch.increment(key));
   }
 };
 
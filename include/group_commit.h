@@ -0,0 +1,222 @@
+#if !defined(_GROUP_COMMIT_H_)
+#define _GROUP_COMMIT_H_
+
+#include "cn_view.h"
+#include "nap_common.h"
+#include "nap_meta.h"
+#include "nvm.h"
+#include "timer.h"
+#include "topology.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace nap {
+
+enum DurabilityMode {
+  DURABILITY_STRICT,  // a hot write is persistent when it returns
+  DURABILITY_RELAXED, // hot writes are persisted by group commits
+};
+
+// Relaxed durability for tenants that can lose the last few milliseconds,
+// e.g., counters and rate limiters.  A hot write only updates its CNView
+// entry and queues it, once, for the committer of its node; the committer
+// writes the newest value of each queued entry to the PC-View and fences
+// twice per batch, so repeated writes of a key are coalesced in DRAM.  An
+// idle committer sleeps until its interval ends, a batch is queued or a
+// waiter hurries it.
+//
+// Time is counted in TSC ticks: every write returned before ``watermark()``
+// is persistent.
+class GroupCommitter {
+private:
+  constexpr static uint32_t kQueueSize = 4096;
+
+  struct PendingCommit {
+    NapMeta *meta;
+    CNView::Entry *e;
+  };
+
+  // written by one worker thread, drained by the committer of its node
+  struct alignas(kCachelineSize) CommitQueue {
+    std::atomic<uint64_t> tail;
+    char padding[kCachelineSize - sizeof(uint64_t)];
+    std::atomic<uint64_t> head;
+    PendingCommit items[kQueueSize];
+
+    CommitQueue() : tail(0), head(0) {}
+  };
+
+  struct StagedCommit {
+    CNView::Entry *e;
+    NapMeta *meta;
+    PCView::Staged staged;
+  };
+
+  struct alignas(kCachelineSize) Committer {
+    std::thread th;
+    std::atomic<uint64_t> watermark;
+    std::vector<StagedCommit> round; // only touched by the committer
+
+    Committer() : watermark(0) {}
+  };
+
+  // how long an idle committer sleeps before it looks at the queues again
+  constexpr static int kIdleSleepUs = 50;
+
+  CommitQueue *queues; // per thread
+  Committer committers[Topology::kNumaCnt];
+  double interval_ms;
+  size_t batch;
+  std::atomic<uint64_t> urgent; // a waiter does not want to wait an interval
+  std::atomic_bool running;
+
+  // drain the queues of ``node``'s threads; return when the round started.
+  // The values are written to the PC-View first and installed after a
+  // single fence, so a round fences twice however many entries it commits.
+  uint64_t commit_round(int node) {
+    mfence();
+    uint64_t start = asm_rdtsc();
+    mfence();
+
+    auto &round = committers[node].round;
+    for (int t = 0; t < kMaxThreadCnt; ++t) {
+      if (Topology::numaIDOf(t) != node) {
+        continue;
+      }
+
+      auto &q = queues[t];
+      uint64_t head = q.head.load(std::memory_order_relaxed);
+      uint64_t tail = q.tail.load(std::memory_order_acquire);
+      for (; head < tail; ++head) {
+        auto &item = q.items[head % kQueueSize];
+        auto *e = item.e;
+
+        e->l.wLock();
+        if (e->commit_pending) {
+          e->commit_pending = false;
+          round.push_back({e, item.meta,
+                           item.meta->sp_view->stage(
+                               node, e->sp_view_index, Slice(e->v),
+                               e->pending_ver, e->is_deleted)});
+        }
+        e->l.wUnlock();
+      }
+      q.head.store(head, std::memory_order_release);
+    }
+
+    persistent::persistent_barrier(); // the values before their pointers
+    for (auto &c : round) {
+      c.e->l.wLock();
+      c.meta->sp_view->install(c.staged);
+      c.e->dirty = true; // for the checkpoint, which reads the PC-View
+      c.e->l.wUnlock();
+    }
+    round.clear();
+
+    persistent::persistent_barrier();
+    return start;
+  }
+
+  // stop counting once there is a batch
+  size_t pending(int node) {
+    size_t res = 0;
+    for (int t = 0; t < kMaxThreadCnt && res < batch; ++t) {
+      if (Topology::numaIDOf(t) == node) {
+        res += queues[t].tail.load(std::memory_order_relaxed) -
+               queues[t].head.load(std::memory_order_relaxed);
+      }
+    }
+    return res;
+  }
+
+  void run(int node) {
+    Topology::setThreadID(Topology::committerID(node));
+    // see Topology::setHelperCore for where committers run
+    bindHelper(Topology::HELPER_COMMITTER, node);
+
+    auto &c = committers[node];
+    uint64_t served = 0;
+    Timer timer;
+    timer.begin();
+    while (running.load(std::memory_order_relaxed)) {
+      uint64_t r = urgent.load(std::memory_order_acquire);
+      double left_us = interval_ms * 1e3 - timer.end() / 1e3;
+      if (r == served && left_us > 0 && pending(node) < batch) {
+        usleep(std::min<double>(left_us, kIdleSleepUs));
+        continue;
+      }
+
+      served = r;
+      c.watermark.store(commit_round(node), std::memory_order_release);
+      timer.begin();
+    }
+
+    c.watermark.store(commit_round(node), std::memory_order_release);
+  }
+
+public:
+  GroupCommitter(double interval_ms, size_t batch)
+      : interval_ms(interval_ms), batch(batch), urgent(0), running(true) {
+    queues = new CommitQueue[kMaxThreadCnt];
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      committers[n].th = std::thread(&GroupCommitter::run, this, n);
+    }
+  }
+
+  ~GroupCommitter() {
+    running.store(false);
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      committers[n].th.join();
+    }
+    delete[] queues;
+  }
+
+  void set(double interval_ms, size_t batch) {
+    this->interval_ms = interval_ms;
+    this->batch = batch;
+    mfence();
+  }
+
+  // called under the entry lock of ``e``, not yet pending; false if the
+  // queue is full and the caller has to persist the write by itself
+  bool enqueue(NapMeta *meta, CNView::Entry *e) {
+    auto &q = queues[Topology::threadID()];
+    uint64_t tail = q.tail.load(std::memory_order_relaxed);
+    if (tail - q.head.load(std::memory_order_acquire) == kQueueSize) {
+      return false;
+    }
+
+    q.items[tail % kQueueSize] = {meta, e};
+    q.tail.store(tail + 1, std::memory_order_release);
+    e->commit_pending = true;
+    return true;
+  }
+
+  uint64_t watermark() {
+    uint64_t res = committers[0].watermark.load(std::memory_order_acquire);
+    for (int n = 1; n < Topology::kNumaCnt; ++n) {
+      res = std::min(res,
+                     committers[n].watermark.load(std::memory_order_acquire));
+    }
+    return res;
+  }
+
+  // ask the committers for a round now instead of after the interval
+  void hurry() { urgent.fetch_add(1, std::memory_order_release); }
+
+  bool is_durable(uint64_t ts) { return watermark() >= ts; }
+
+  // block until every write returned before ``ts`` is persistent
+  void wait(uint64_t ts) {
+    hurry();
+    while (!is_durable(ts)) {
+      mfence();
+    }
+  }
+};
+
+} // namespace nap
+
+#endif // _GROUP_COMMIT_H_
@@ -0,0 +1,162 @@
+#if !defined(_HOT_KEY_DETECTOR_H_)
+#define _HOT_KEY_DETECTOR_H_
+
+#include "count_min_sketch.h"
+#include "nap_common.h"
+#include "record_ring.h"
+#include "slice.h"
+#include "stream_summary.h"
+#include "tiny_lfu.h"
+#include "top_k.h"
+#include "topology.h"
+
+#include <vector>
+
+namespace nap {
+
+enum DetectorType {
+  DETECTOR_COUNT_MIN,    // count-min sketch + min heap
+  DETECTOR_SPACE_SAVING, // stream-summary
+  DETECTOR_TINY_LFU,     // doorkeeper + count-min sketch + min heap
+};
+
+// What Nap needs from a hot-key detector.  ``record`` is called by worker
+// threads on sampled operations; the rest only by the shift thread.
+class HotKeyDetector {
+public:
+  virtual ~HotKeyDetector() {}
+
+  virtual void record(const Slice &key, bool is_write) = 0;
+
+  // consume samples for ``seconds``
+  virtual void poll_workloads(double seconds) = 0;
+
+  // halve all frequencies, so history fades out instead of being dropped
+  virtual void decay() = 0;
+
+  virtual void reset() = 0;
+
+  // the top-N keys with their estimated counts, of which ``write_cnt`` were
+  // writes and ``home_cnt`` came from ``home_node``; slot 0 is a fence
+  virtual std::vector<Node> &get_list() = 0;
+
+  virtual uint64_t dropped_samples() = 0;
+
+  // whether samples arrive faster than they are consumed
+  virtual bool is_saturated() = 0;
+};
+
+// Per-thread sample rings drained into a frequency estimator ``E``, which
+// provides access_a_key(const Slice &), decay(), reset() and get_list().
+// Writes and the samples of each node are counted once more in small
+// sketches, only to split the counts of the reported keys by operation and
+// by origin node.
+template <class E> class SampledDetector : public HotKeyDetector {
+private:
+  constexpr static int kSideSketchShift = 18;
+
+  RecordRing ring;
+  E estimator;
+  CountMinSketch write_sketch;
+  CountMinSketch *node_sketch[Topology::kNumaCnt];
+
+public:
+  SampledDetector(int hot_keys_cnt, int thread_begin = 0,
+                  int thread_end = kMaxThreadCnt)
+      : ring(thread_begin, thread_end), estimator(hot_keys_cnt),
+        write_sketch(kSideSketchShift) {
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      node_sketch[n] = nullptr;
+      // threads of [thread_begin, thread_end) only sample on these nodes
+      if (n >= Topology::numaIDOf(thread_begin) &&
+          n <= Topology::numaIDOf(thread_end - 1)) {
+        node_sketch[n] = new CountMinSketch(kSideSketchShift);
+      }
+    }
+  }
+
+  ~SampledDetector() {
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      if (node_sketch[n]) {
+        delete node_sketch[n];
+      }
+    }
+  }
+
+  void record(const Slice &key, bool is_write) override {
+    ring.record(key, is_write);
+  }
+
+  void poll_workloads(double seconds) override {
+    ring.poll(seconds, [this](const Slice &key, bool is_write, int tid) {
+      estimator.access_a_key(key);
+      if (is_write) {
+        write_sketch.increment(key);
+      }
+      node_sketch[Topology::numaIDOf(tid)]->increment(key);
+    });
+  }
+
+  void decay() override {
+    estimator.decay();
+    write_sketch.decay();
+    for (auto *s : node_sketch) {
+      if (s) {
+        s->decay();
+      }
+    }
+  }
+
+  void reset() override {
+    estimator.reset();
+    write_sketch.reset();
+    for (auto *s : node_sketch) {
+      if (s) {
+        s->reset();
+      }
+    }
+  }
+
+  std::vector<Node> &get_list() override {
+    auto &l = estimator.get_list();
+    for (size_t i = 1; i < l.size(); ++i) {
+      auto &node = l[i];
+      node.write_cnt = std::min(node.cnt, write_sketch.estimate(node.key));
+
+      node.home_node = -1;
+      node.home_cnt = 0;
+      for (int n = 0; n < Topology::kNumaCnt; ++n) {
+        int cnt = node_sketch[n] ? node_sketch[n]->estimate(node.key) : 0;
+        if (cnt > node.home_cnt) {
+          node.home_node = n;
+          node.home_cnt = std::min(node.cnt, cnt);
+        }
+      }
+    }
+    return l;
+  }
+
+  uint64_t dropped_samples() override { return ring.dropped_samples(); }
+
+  bool is_saturated() override { return ring.is_saturated(); }
+};
+
+inline HotKeyDetector *new_detector(DetectorType type, int hot_keys_cnt,
+                                    int thread_begin = 0,
+                                    int thread_end = kMaxThreadCnt) {
+  switch (type) {
+  case DETECTOR_SPACE_SAVING:
+    return new SampledDetector<StreamSummary>(hot_keys_cnt, thread_begin,
+                                              thread_end);
+  case DETECTOR_TINY_LFU:
+    return new SampledDetector<TinyLFU>(hot_keys_cnt, thread_begin,
+                                        thread_end);
+  default:
+    return new SampledDetector<CountMin>(hot_keys_cnt, thread_begin,
+                                         thread_end);
+  }
+}
+
+} // namespace nap
+
+#endif // _HOT_KEY_DETECTOR_H_
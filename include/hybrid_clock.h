@@ -0,0 +1,38 @@
+#if !defined(_HYBRID_CLOCK_H_)
+#define _HYBRID_CLOCK_H_
+
+#include "nap_common.h"
+#include "topology.h"
+
+#include <algorithm>
+
+namespace nap {
+
+// Versions for GLOBAL_VERSION, from a hybrid logical clock per thread: the
+// TSC in the high bits and the thread id in the low ones, kept ahead of
+// every version the thread has issued or observed.  A write of a key
+// observes the previous version of that key under its entry lock, so the
+// versions of a key grow across threads and nodes, and flushing can pick
+// the newest incarnation among the NUMA replicas; across keys, versions
+// follow real time up to the TSC skew between sockets.  There is no shared
+// counter on the write path.
+class HybridClock {
+  constexpr static int kTickShift = 4; // 16-cycle ticks
+  constexpr static int kThreadBits = 7;
+  static_assert(kMaxThreadCnt <= (1 << kThreadBits), "XX");
+
+public:
+  // a version larger than ``observed``
+  static uint64_t next(uint64_t observed) {
+    thread_local static uint64_t last = 0;
+
+    uint64_t now = (asm_rdtsc() >> kTickShift << kThreadBits) |
+                   (Topology::threadID() & ((1 << kThreadBits) - 1));
+    last = std::max({now, last + 1, observed + 1});
+    return last;
+  }
+};
+
+} // namespace nap
+
+#endif // _HYBRID_CLOCK_H_
@@ -14,6 +14,7 @@
 #include "pmdk_helper.h"
 
 #include "NUMA_Config.h"
+#include "../rw_lock.h"
 
 #if LIBPMEMOBJ_CPP_USE_TBB_RW_MUTEX
 #include "tbb/spin_rw_mutex.h"
@@ -44,40 +45,9 @@
 #define CAS(ptr, oldval, newval)                                               \
   (__sync_bool_compare_and_swap(ptr, oldval, newval))
 
-struct DirLock {
-  static const int kMaxLockThread = 73;
-  volatile uint64_t locks[kMaxLockThread][8];
-
-  DirLock() {
-    for (int i = 0; i < kMaxLockThread; ++i) {
-      locks[i][0] = 0;
-    }
-  }
-
-  bool write_lock() {
-    for (int i = 0; i < kMaxLockThread; ++i) {
-      while (!CAS(&locks[i][0], 0, 1)) {
-      }
-    }
-    return true;
-  }
-
-  bool read_lock() {
-    while (!CAS(&locks[my_thread_id][0], 0, 1)) {
-    }
-    return true;
-  }
-
-  void write_unlock() {
-    for (int i = 0; i < kMaxLockThread; ++i) {
-      locks[i][0] = 0;
-    }
-  }
-
-  void read_unlock() { locks[my_thread_id][0] = 0; }
-};
-
-DirLock dir_lock;
+// directory doubling and splitting write-lock the directory, lookups of a
+// segment read-lock it
+nap::NumaRWLock dir_lock;
 
 #if _MSC_VER
 #include <intrin.h>
@@ -575,7 +545,7 @@ public:
        accessing a reclaimed directory, which guarantees the
        thread safety for directory. */
 
-    dir_lock.read_lock();
+    dir_lock.read_lock(my_thread_id);
 
     // scoped_t lock_dir(dir->m,
     // 		  false); // directory reader lock
@@ -594,14 +564,14 @@ public:
           key_equal{}(key, target_segment->slots[location].get_key(),
                       key_len)) {
 
-        dir_lock.read_unlock();
+        dir_lock.read_unlock(my_thread_id);
         // lock_dir.release();
         lock_target_segment.release();
         return ret(x, y);
       }
     }
 
-    dir_lock.read_unlock();
+    dir_lock.read_unlock(my_thread_id);
     // lock_dir.release();
     lock_target_segment.release();
     return ret();
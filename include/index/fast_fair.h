@@ -20,6 +20,7 @@
 #endif
 
 #include "index/NUMA_Config.h"
+#include "nvm.h"
 
 namespace fastfair {
 
@@ -56,6 +57,11 @@ static inline void mfence() { asm volatile("mfence" ::: "memory"); }
 
 #define CLWB 1
 static inline void clflush(char *data, int len) {
+  if (!persistent::flush_needed()) { // see persistent::persist_policy
+    persistent::persistent_barrier();
+    return;
+  }
+
   volatile char *ptr = (char *)((unsigned long)data & ~(CACHE_LINE_SIZE - 1));
   mfence();
   for (; ptr < data + len; ptr += CACHE_LINE_SIZE) {
@@ -0,0 +1,301 @@
+#if !defined(_LOG_VIEW_H_)
+#define _LOG_VIEW_H_
+
+#include "murmur_hash2.h"
+#include "nap_common.h"
+#include "nvm.h"
+#include "slice.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace nap {
+
+// A log-structured PC-View.  Instead of updating a slot in place, which is a
+// random 64B PM write per put, each thread appends (slot index, version,
+// value) records to its own log on its NUMA node.  The logs start at an
+// XPLine and only grow, so Optane sees sequential, combinable writes.  A
+// DRAM index remembers the newest record of each slot; the logs are freed
+// with the view, once the epoch is switched and the view is flushed.
+//
+// The chunks of each log are chained in PM from a per-view directory, so
+// ``recover`` can rebuild the DRAM index by scanning the logs: a log ends
+// at its first record whose checksum does not match.
+class LogView {
+  friend class NapMeta;
+
+public:
+  // for SPView compatibility: the logs are allocated as they grow
+  struct Arena {};
+
+  LogView() : log_id(0), dir(nullptr) {}
+
+  // ``home_cnt`` and ``arena`` are accepted for SPView compatibility: every
+  // record is already written to the writer's own node.
+  LogView(const std::vector<std::pair<std::string, WhereIsData>> &list,
+          const std::vector<size_t> &home_cnt = {}, Arena *arena = nullptr)
+      : log_id(asm_rdtsc()), latest(list.size(), nullptr),
+        ckpt_ver(list.size(), 0) {
+    keys.reserve(list.size());
+    for (auto &p : list) {
+      keys.push_back(p.first);
+    }
+
+    PMEMoid oid;
+    pmemobj_zalloc(Topology::pmdk_pool_at(0)->handle(), &oid,
+                   sizeof(Directory), 0);
+    dir = (Directory *)pmemobj_direct(oid);
+    dir->log_id = log_id;
+    persistent::clwb_range(dir, sizeof(Directory));
+  }
+
+  ~LogView() {
+    for (auto &log : logs) {
+      for (auto *chunk : log.chunks) {
+        PMEMoid oid = pmemobj_oid(chunk);
+        pmemobj_free(&oid);
+      }
+    }
+    if (dir) {
+      PMEMoid oid = pmemobj_oid(dir);
+      pmemobj_free(&oid);
+    }
+  }
+
+  char *alloc_before_update(const Slice &key, const Slice &value) {
+    return nullptr; // space is taken from the thread's log in ``update``
+  }
+
+  void update(int index, char *ptr, const Slice &key, const Slice &value,
+              uint64_t new_version, bool is_del = false) {
+
+    uint64_t v = new_version; // see CNView::Entry::next_version
+
+    int id = Topology::threadID();
+    append(id, Topology::numaIDOf(id), index, value, v, is_del);
+    persistent::persistent_barrier();
+  }
+
+  // for SPView compatibility: a record is installed once it is appended
+  struct Staged {};
+
+  // a group commit of slot ``index`` on behalf of the writers of ``node``,
+  // to the committer's log of that node; the caller fences once for the
+  // whole batch.
+  Staged stage(int node, size_t index, const Slice &value, uint64_t ver,
+               bool is_del) {
+    append(kMaxThreadCnt + node, node, index, value, ver, is_del);
+    return {};
+  }
+
+  void install(const Staged &s) {}
+
+  bool load_latest(size_t index, uint64_t &ver, std::string &value,
+                   bool &is_del) {
+    auto *r = latest[index];
+    if (r == nullptr) {
+      return false;
+    }
+
+    ver = r->version;
+    is_del = r->size & LogRecord::kDeleted;
+    value.assign(r->get_val(), r->get_size());
+    return true;
+  }
+
+  bool is_flushed(size_t index, uint64_t ver) {
+    return ckpt_ver[index] > ver;
+  }
+
+  // only kept in DRAM: after a crash the whole log is written back again,
+  // which is idempotent
+  void mark_flushed(size_t index, uint64_t ver) { ckpt_ver[index] = ver + 1; }
+
+  // rebuild the DRAM state from the directory alone, as after a crash; the
+  // logs are appended to where the scan stopped
+  void recover() {
+    log_id = dir->log_id;
+    std::fill(latest.begin(), latest.end(), nullptr);
+    std::fill(ckpt_ver.begin(), ckpt_ver.end(), 0);
+
+    for (int i = 0; i < kLogCnt; ++i) {
+      auto &log = logs[i];
+      log.chunks.clear();
+      log.tail = log.end = nullptr;
+      for (PMEMoid oid = dir->heads[i]; !OID_IS_NULL(oid);) {
+        char *chunk = (char *)pmemobj_direct(oid);
+        auto *h = header_of(chunk);
+        log.chunks.push_back(chunk);
+        log.tail = (char *)h + kXPLineSize;
+        log.end = log.tail + h->capacity;
+        scan(log);
+        oid = h->next;
+      }
+    }
+  }
+
+  // slots [begin, end) only, if given
+  template <class T>
+  void flush_to_raw_index(T *raw_index, size_t begin = 0,
+                          size_t end = SIZE_MAX) {
+    std::string value;
+    for (size_t i = begin; i < std::min(end, latest.size()); ++i) {
+      uint64_t ver;
+      bool is_del;
+      if (!load_latest(i, ver, value, is_del) || is_flushed(i, ver)) {
+        continue;
+      }
+
+      write_to(raw_index, i, value, is_del);
+    }
+  }
+
+  template <class T>
+  void write_back(T *raw_index, size_t index, uint64_t ver,
+                  const std::string &value, bool is_del) {
+    write_to(raw_index, index, value, is_del);
+    mark_flushed(index, ver);
+  }
+
+  size_t get_size() const { return latest.size(); }
+
+private:
+  // followed by ``size`` bytes of value, padded to 8B
+  struct __attribute__((__packed__)) LogRecord {
+    constexpr static uint32_t kDeleted = 1u << 31;
+
+    uint32_t index;
+    uint32_t size; // kDeleted is set for a deletion
+    uint64_t version;
+    uint32_t check; // of the whole record, detects torn or stale records
+    uint32_t padding;
+
+    static size_t length_for(size_t value_size) {
+      return (sizeof(LogRecord) + value_size + 7) & ~(size_t)7;
+    }
+
+    uint32_t get_size() { return size & ~kDeleted; }
+
+    char *get_val() { return (char *)this + sizeof(LogRecord); }
+  };
+
+  static_assert(sizeof(LogRecord) == 24, "XX");
+  constexpr static size_t kLogChunkSize = 4 * 1024 * 1024;
+  constexpr static int kLogCnt = kMaxThreadCnt + Topology::kNumaCnt; // + group commits
+
+  // in the first XPLine of a chunk, the records follow in the next ones
+  struct ChunkHeader {
+    PMEMoid next; // the next chunk of the log, or OID_NULL
+    uint64_t capacity; // bytes of records
+  };
+
+  // persistent: where each log starts
+  struct Directory {
+    uint64_t log_id;
+    PMEMoid heads[kLogCnt];
+  };
+
+  struct alignas(kCachelineSize) ThreadLog {
+    char *tail; // next append position
+    char *end;  // end of the current chunk
+    std::vector<char *> chunks; // as allocated
+
+    ThreadLog() : tail(nullptr), end(nullptr) {}
+  };
+
+  uint64_t log_id; // seeds the checksums, so old logs never validate
+  Directory *dir;
+  ThreadLog logs[kLogCnt];
+  std::vector<LogRecord *> latest; // DRAM index: newest record of each slot
+  std::vector<uint64_t> ckpt_ver;  // latest version written back, plus 1
+  std::vector<std::string> keys;
+
+  template <class T>
+  void write_to(T *raw_index, size_t index, const std::string &value,
+                bool is_del) {
+    if (is_del) {
+      raw_index->del(Slice(keys[index]));
+    } else {
+      raw_index->put(Slice(keys[index]), Slice(value), true);
+    }
+  }
+
+  // of the header up to ``check``, then of the value
+  uint32_t checksum(LogRecord *r) {
+    uint64_t seed = MurmurHash64A(r, offsetof(LogRecord, check), log_id);
+    return MurmurHash64A(r->get_val(), r->get_size(), seed);
+  }
+
+  static ChunkHeader *header_of(char *chunk) {
+    return (ChunkHeader *)(((uintptr_t)chunk + kXPLineSize - 1) &
+                           ~(uintptr_t)(kXPLineSize - 1));
+  }
+
+  // index the valid records of ``log``'s current chunk, from ``tail`` on
+  void scan(ThreadLog &log) {
+    while (log.tail + sizeof(LogRecord) <= log.end) {
+      auto *r = (LogRecord *)log.tail;
+      size_t length = LogRecord::length_for(r->get_size());
+      if (r->index >= latest.size() || log.tail + length > log.end ||
+          r->check != checksum(r)) {
+        return; // torn, or what the chunk held before
+      }
+
+      auto *&l = latest[r->index];
+      if (l == nullptr || l->version < r->version) {
+        l = r;
+      }
+      log.tail += length;
+    }
+  }
+
+  // append a record to ``log``, starting a new XPLine-aligned chunk on
+  // ``node`` when it is full; the record is flushed but not fenced
+  void append(int log_index, int node, size_t index, const Slice &value,
+              uint64_t v, bool is_del) {
+    auto &log = logs[log_index];
+    size_t length = LogRecord::length_for(value.size());
+    if (log.tail + length > log.end) {
+      size_t chunk_size = std::max(kLogChunkSize, length);
+      PMEMoid oid;
+      pmemobj_alloc(Topology::pmdk_pool_at(node)->handle(), &oid,
+                    chunk_size + 2 * kXPLineSize - 1, 0, nullptr, nullptr);
+      char *chunk = (char *)pmemobj_direct(oid);
+      auto *h = header_of(chunk);
+      h->next = OID_NULL;
+      h->capacity = chunk_size;
+      persistent::clwb_range(h, sizeof(ChunkHeader)); // before it is linked
+
+      // persisted by the fence of the first record in the chunk
+      PMEMoid *link = log.chunks.empty() ? &dir->heads[log_index]
+                                         : &header_of(log.chunks.back())->next;
+      *link = oid;
+      persistent::clwb_range_nofence(link, sizeof(PMEMoid));
+
+      log.chunks.push_back(chunk);
+      log.tail = (char *)h + kXPLineSize;
+      log.end = log.tail + chunk_size;
+    }
+
+    auto *r = (LogRecord *)log.tail;
+    log.tail += length;
+
+    r->index = index;
+    r->size = value.size() | (is_del ? LogRecord::kDeleted : 0);
+    r->version = v;
+    r->padding = 0;
+    memcpy(r->get_val(), value.data(), value.size());
+    r->check = checksum(r);
+
+    persistent::clwb_range_nofence(r, length);
+
+    // writers of a slot are serialized by the lock of its CNView entry
+    latest[index] = r;
+  }
+};
+
+} // namespace nap
+
+#endif // _LOG_VIEW_H_
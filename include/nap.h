@@ -1,9 +1,11 @@
 #if !defined(_NAP_H_)
 #define _NAP_H_
 
-#include "count_min_sketch.h"
+#include "group_commit.h"
+#include "hot_key_detector.h"
 #include "nap_common.h"
 #include "nap_meta.h"
+#include "numa_aggregator.h"
 #include "slice.h"
 #include "timer.h"
 #include "topology.h"
@@ -11,17 +13,50 @@
 #include <algorithm>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace nap {
 
+enum SampleOpType {
+  SAMPLE_READ,
+  SAMPLE_WRITE, // put and del
+  SAMPLE_TYPE_CNT,
+};
+
+// who runs the switch: sampling, the switch phases, flushing and relocation
+enum ShiftMode {
+  SHIFT_DEDICATED,   // a shift thread pinned to core 0
+  SHIFT_COOPERATIVE, // worker threads, in small steps between operations
+  SHIFT_BACKGROUND,  // workers; a low-priority thread decides, or sleeps
+};
+
+enum ShiftPhase {
+  SHIFT_POLL,        // sample and checkpoint until the interval ends
+  SHIFT_PREPARE,     // until a preparer thread decides on the next hot set
+  SHIFT_WAIT_EPOCH,  // until all threads learn the new epoch
+  SHIFT_WAIT_COMMIT, // until group commits to the old view are persistent
+  SHIFT_FLUSH,       // flush the old NAL into the raw index
+  SHIFT_RELOCATE,    // finish lazy initialization
+  SHIFT_GRACE,       // a grace period before freeing the old meta
+};
+
 struct alignas(kCachelineSize) ThreadMeta {
   uint64_t epoch;
   uint64_t op_seq;
   uint64_t hit_in_cap;
   bool is_in_nap;
-
-  ThreadMeta() : epoch(0), op_seq(0), hit_in_cap(0), is_in_nap(false) {}
+  uint32_t sample_countdown[SAMPLE_TYPE_CNT];
+  uint32_t help_countdown; // operations until the next switch step
+
+  ThreadMeta()
+      : epoch(0), op_seq(0), hit_in_cap(0), is_in_nap(false),
+        help_countdown(1) {
+    for (int i = 0; i < SAMPLE_TYPE_CNT; ++i) {
+      sample_countdown[i] = 1;
+    }
+  }
 };
 
 extern pmem::obj::pool_base pop_numa[kMaxNumaCnt];
@@ -68,12 +103,55 @@ template <class T> class Nap {
 private:
   T *raw_index;
 
-  CountMin *CM;
+  HotKeyDetector *CM;
+  DetectorType detector_type;
   int hot_cnt;
 
-  int kSampleInterval{1};
+  // sample one of every kSampleInterval[type] operations; adapted by the
+  // shift thread to the detector's headroom if adaptive_sampling is set
+  int kSampleInterval[SAMPLE_TYPE_CNT]{1, 1};
+  bool adaptive_sampling{false};
+  const int kMaxSampleInterval = 1024;
   double kSwitchInterval{5.0};
 
+  // hot keys with a smaller share of writes get a DRAM read cache entry
+  // instead of a NAL slot, e.g., 0.01; < 0 disables the classification
+  double kReadCacheWriteShare{-1};
+
+  // hot keys with at least this share of samples from one node only get a
+  // PC-View slot on that node, e.g., 0.9; > 1 disables the placement
+  double kHomeNodeShare{2};
+
+  // place PC-View slots by write heat and origin node rather than randomly
+  bool xpline_placement{false};
+
+  // the readers of this many hottest keys use per-node counters in their
+  // entry lock, e.g., 64; 0 disables them
+  size_t kNodeReaderKeys{0};
+
+  // puts to this many hottest keys are combined per node, e.g., 64; 0
+  // disables it
+  size_t kCombiningKeys{0};
+
+  // threads, one per node at most, that load new hot keys from the raw
+  // index right after a switch, e.g., Topology::kNumaCnt; 0 leaves that to
+  // their first readers
+  int kWarmThreads{0};
+
+  // run by each warmer with its Topology::warmerID() before it reads the raw
+  // index, e.g., to set the thread id the index uses for its locks
+  void (*thread_init)(int thread_id){nullptr};
+
+  // hot writes are persisted by per-NUMA group commits if relaxed
+  DurabilityMode durability{DURABILITY_STRICT};
+  GroupCommitter *committer{nullptr};
+
+  // background write-back of dirty NAL entries, disabled if <= 0
+  double kCheckpointInterval{0};
+  size_t kCheckpointBatch{1024};
+  size_t ckpt_cursor{0};
+  Timer ckpt_timer;
+
   // In PM
   NapMeta *g_cur_meta;
   NapMeta *g_pre_meta;
@@ -87,13 +165,202 @@ private:
 
   std::atomic<uint64_t> g_cur_epoch;
   std::atomic<uint64_t> epoch_seq_lock;
-  ReadFirendlyLock data_race_lock;
-  ReadFirendlyLock shift_global_lock;
+  NumaRWLock data_race_lock;
+  NumaRWLock shift_global_lock;
 
   void init_pmdk_pool();
 
+  // double-buffered memory of the metas, see MetaArena
+  MetaArena arenas[2];
+
+  MetaArena *free_arena() {
+    for (auto &a : arenas) {
+      if (!a.in_use) {
+        return &a;
+      }
+    }
+    return nullptr; // allocate as usual
+  }
+
+  // the switch, as a sequence of steps, see shift_step
+  constexpr static int kPreHotest = 8;
+  struct ShiftState {
+    std::atomic<ShiftPhase> phase;
+    Timer interval; // since the current polling interval started
+    std::vector<NapPair> cur_list;
+    std::string pre_hotest_keys[kPreHotest];
+    NapMeta *old_meta, *new_meta;
+    uint64_t commit_ts;
+    size_t flush_cursor;
+    CNView::Cursor relocate_cursor;
+    uint64_t grace_seq[kMaxThreadCnt]; // op_seq of each thread at retirement
+    std::vector<std::string> warm_keys; // of the new hot set, hottest first
+    std::vector<std::thread> warmers;
+    std::atomic<int> warming; // warmers still running
+    std::thread preparer; // decides on the next hot set, see SHIFT_PREPARE
+    std::atomic<bool> prepared;
+    NapMeta *next_meta; // nullptr if the hot set stays
+    std::vector<NapPair> next_list;
+
+    ShiftState()
+        : phase(SHIFT_POLL), old_meta(nullptr), new_meta(nullptr),
+          warming(0), prepared(false), next_meta(nullptr) {}
+  } shift;
+
+  ShiftMode shift_mode;
+  std::atomic<bool> shift_busy{false}; // a thread is running a step
+  const uint32_t kHelpInterval = 64;   // operations
+  const double kHelpPollSlice = 0.00001; // seconds
+
+  void shift_init();
+
   void nap_shift();
 
+  void start_interval();
+
+  void shift_step(double poll_slice, bool on_shift_thread = false);
+
+  bool switch_epoch();
+
+  NapMeta *decide_epoch(std::vector<NapPair> &new_list);
+
+  NapMeta *prepare_epoch(std::vector<NapPair> &new_list);
+
+  // hot keys ordered by heat at a switch, e.g., to be warmed in order
+  const size_t kOrderedHotKeys = 1024;
+  // time to pick the next hot set and diff it against the current one
+  uint64_t select_ns{0}, select_cnt{0};
+
+  std::vector<Node> hot_list();
+
+  bool is_skewed(const std::vector<Node> &l);
+
+  void publish_epoch(NapMeta *new_meta, std::vector<NapPair> &new_list);
+
+  void retire_epoch();
+
+  void start_warming();
+
+  void warm(NapMeta *meta, int id, int cnt);
+
+  // under the write lock of ``e``, whose value is still in the raw index
+  bool load_from_raw_index(CNView::Entry *e, const Slice &key,
+                           std::string &value) {
+    e->location = WhereIsData::IN_CURRENT_EPOCH;
+    bool res = raw_index->get(key, value);
+
+    if (res) {
+      e->v = value;
+    } else {
+      e->is_deleted = true;
+    }
+    return res;
+  }
+
+  // Runtime bypass, see set_enabled.  Only the switch changes ``bypass``:
+  // its steps and the preparer of SHIFT_PREPARE.
+  enum BypassState {
+    BYPASS_OFF,      // Nap serves
+    BYPASS_DRAINING, // switching to an empty hot set, i.e., flushing the NAL
+    BYPASS_ON,       // operations go to the raw index directly
+    BYPASS_RESUMING, // Nap serves again, but must not load a hot set yet
+  };
+  std::atomic<BypassState> bypass{BYPASS_OFF};
+  std::atomic<bool> bypassed{false}; // checked by every operation
+  std::atomic<bool> want_enabled{true};
+  bool auto_enable{true};
+
+  bool drain_epoch();
+
+  bool resume_from_bypass();
+
+  // the NAL is empty: nothing is lost by skipping Nap
+  void bypass_all() {
+    bypassed.store(true);
+    bypass = BYPASS_ON;
+  }
+
+  // run a step unless another thread is running one; false if it did not
+  bool try_shift_step(double poll_slice, bool on_shift_thread = false) {
+    if (shift_busy.load(std::memory_order_relaxed) ||
+        shift_busy.exchange(true, std::memory_order_acquire)) {
+      return false;
+    }
+    shift_step(poll_slice, on_shift_thread);
+    shift_busy.store(false, std::memory_order_release);
+    return true;
+  }
+
+  // at the end of an operation: in the cooperative modes, every
+  // kHelpInterval operations take a step of the switch
+  void help_shift(ThreadMeta &m) {
+    if (shift_mode == SHIFT_DEDICATED || --m.help_countdown > 0) {
+      return;
+    }
+    m.help_countdown = kHelpInterval;
+    try_shift_step(kHelpPollSlice);
+  }
+
+  void adapt_sampling(const std::vector<Node> &l);
+
+  bool is_read_only(const Node &n) {
+    double reads = (n.cnt - n.write_cnt) * 1.0 * kSampleInterval[SAMPLE_READ];
+    double writes = n.write_cnt * 1.0 * kSampleInterval[SAMPLE_WRITE];
+    return writes <= kReadCacheWriteShare * (reads + writes);
+  }
+
+  int home_node_of(const Node &n) {
+    if (n.home_node < 0 || n.home_cnt < kHomeNodeShare * n.cnt) {
+      return -1;
+    }
+    return n.home_node;
+  }
+
+  // wait until the previous NAL is flushed, without blocking the switch
+  void wait_for_pre_meta(ThreadMeta &thread_meta) {
+    thread_meta.is_in_nap = false;
+    while (g_pre_meta != nullptr) {
+      if (shift_mode != SHIFT_DEDICATED) { // nobody else may run the switch
+        try_shift_step(kHelpPollSlice);
+      }
+      mfence();
+    }
+    thread_meta.is_in_nap = true;
+  }
+
+  bool write_read_cache(NapMeta *pre_meta, CNView::Entry *e,
+                        const Slice &key, const Slice &value, bool is_update,
+                        bool is_del);
+
+  // under the entry lock of a hot write: leave its PC-View update to the
+  // group committer; false if the caller has to persist it by itself
+  bool defer_update(NapMeta *meta, CNView::Entry *e) {
+    if (durability != DURABILITY_RELAXED) {
+      return false;
+    }
+    if (!e->commit_pending && !committer->enqueue(meta, e)) {
+      return false; // the queue is full
+    }
+    e->pending_ver = e->next_version();
+    return true;
+  }
+
+  // under the put lock of ``e``, which is not shifting
+  void apply_put(NapMeta *cur_meta, NapMeta *pre_meta, CNView::Entry *e,
+                 const Slice &key, const Slice &value, char *alloc_ptr);
+
+  bool combine_put(NapMeta *cur_meta, NapMeta *pre_meta, CNView::Entry *e,
+                   const Slice &key, const Slice &value);
+
+  void sample(ThreadMeta &m, SampleOpType type, const Slice &key) {
+    if (--m.sample_countdown[type] == 0) {
+      m.sample_countdown[type] = kSampleInterval[type];
+      CM->record(key, type == SAMPLE_WRITE);
+    }
+  }
+
+  void poll_and_checkpoint(double seconds);
+
   bool find_in_views(CNView::Entry *e, NapMeta *pre_meta, const Slice &key,
                      std::string &value);
 
@@ -103,7 +370,11 @@ private:
   std::atomic_bool shift_thread_is_ready;
 
 public:
-  Nap(T *raw_index, int hot_cnt = kHotKeys);
+  // ``detector`` picks the hot-key detector of this instance, ``shift``
+  // how its switch runs
+  Nap(T *raw_index, int hot_cnt = kHotKeys,
+      DetectorType detector = DETECTOR_COUNT_MIN,
+      ShiftMode shift = SHIFT_DEDICATED);
   ~Nap();
 
   void put(const Slice &key, const Slice &value, bool is_update = false);
@@ -135,10 +406,82 @@ public:
 #endif
   }
 
-  void recovery() { g_cur_meta->flush_sp_view(raw_index); }
+  void recovery() {
+#ifdef LOG_STRUCTURED_NAL
+    g_cur_meta->sp_view->recover(); // its DRAM index does not survive a crash
+#endif
+    g_cur_meta->flush_sp_view(raw_index);
+  }
 
   void set_sampling_interval(int v) {
-    kSampleInterval = v;
+    for (int i = 0; i < SAMPLE_TYPE_CNT; ++i) {
+      kSampleInterval[i] = v;
+    }
+    mfence();
+  }
+
+  // e.g., sample writes more densely, since writes are what the NAL absorbs
+  void set_sampling_interval(SampleOpType type, int v) {
+    kSampleInterval[type] = v;
+    mfence();
+  }
+
+  int get_sampling_interval(SampleOpType type) {
+    return kSampleInterval[type];
+  }
+
+  // off by default: it would override set_sampling_interval
+  void set_adaptive_sampling(bool v) {
+    adaptive_sampling = v;
+    mfence();
+  }
+
+  uint64_t dropped_samples() { return CM->dropped_samples(); }
+
+  // hot keys whose writes are below ``share`` of their accesses are cached
+  // in DRAM only; writes to them go through to the raw index.
+  void set_read_cache_write_share(double share) {
+    kReadCacheWriteShare = share;
+    mfence();
+  }
+
+  // hot keys sampled on one node for at least ``share`` of the time keep a
+  // PC-View slot on that node only, e.g., connection-affine sessions.
+  void set_home_node_share(double share) {
+    kHomeNodeShare = share;
+    mfence();
+  }
+
+  // CoW values of at least ``bytes`` are streamed to PM with non-temporal
+  // stores, replacing the threshold calibrated at startup; -1 never streams.
+  void set_nt_store_threshold(size_t bytes) {
+    nt_store_threshold = bytes;
+    mfence();
+  }
+
+  void set_xpline_placement(bool v) {
+    xpline_placement = v;
+    mfence();
+  }
+
+  void set_node_reader_keys(size_t n) {
+    kNodeReaderKeys = n;
+    mfence();
+  }
+
+  void set_combining_keys(size_t n) {
+    kCombiningKeys = n;
+    mfence();
+  }
+
+  // warmers have reserved thread ids, one per node
+  void set_warm_threads(int n) {
+    kWarmThreads = std::min(n, Topology::kNumaCnt);
+    mfence();
+  }
+
+  void set_thread_init(void (*f)(int thread_id)) {
+    thread_init = f;
     mfence();
   }
 
@@ -147,6 +490,55 @@ public:
     mfence();
   }
 
+  // DURABILITY_RELAXED: hot writes return before they are persistent, and
+  // are persisted by per-NUMA group commits every ``interval_ms`` or once
+  // ``batch`` of them are pending.  A crash loses at most about that much.
+  void set_durability(DurabilityMode mode, double interval_ms = 1,
+                      size_t batch = 256) {
+    if (mode == DURABILITY_RELAXED) {
+      if (committer == nullptr) {
+        committer = new GroupCommitter(interval_ms, batch);
+      } else {
+        committer->set(interval_ms, batch);
+      }
+    }
+    mfence();
+    durability = mode;
+    mfence();
+  }
+
+  // in TSC ticks: every write returned before it is persistent
+  uint64_t durable_watermark() {
+    return committer ? committer->watermark() : asm_rdtsc();
+  }
+
+  // block until every write returned so far is persistent
+  void wait_durable() {
+    if (committer) {
+      committer->wait(asm_rdtsc());
+    }
+  }
+
+  // ``false`` flushes the NAL into the raw index and then sends every
+  // operation to the raw index directly, with sampling only; ``auto_enable``
+  // turns Nap on again once the samples are skewed.  Both happen in the
+  // background, see is_bypassed.
+  void set_enabled(bool enabled, bool auto_enable = true) {
+    this->auto_enable = auto_enable;
+    mfence();
+    want_enabled = enabled;
+  }
+
+  bool is_bypassed() { return bypassed.load(); }
+
+  // bounds both recovery time and staleness of the raw index to about
+  // ``seconds`` plus the time of one checkpoint pass.
+  void set_checkpoint_interval(double seconds, size_t batch = 1024) {
+    kCheckpointInterval = seconds;
+    kCheckpointBatch = batch;
+    mfence();
+  }
+
   void clear() {
     for (int i = 0; i < kMaxThreadCnt; ++i) {
       thread_meta_array[i].op_seq = 0;
@@ -162,12 +554,55 @@ public:
       all_hit += thread_meta_array[i].hit_in_cap;
     }
     printf("nap hit ratio: %f\n", all_hit * 1.0 / all_op);
+    printf("sampling interval: read %d, write %d, dropped samples %lu\n",
+           kSampleInterval[SAMPLE_READ], kSampleInterval[SAMPLE_WRITE],
+           dropped_samples());
+    if (select_cnt > 0) {
+      printf("hot-set selection and diff: %.1f us per decision\n",
+             select_ns / 1000.0 / select_cnt);
+    }
+
+    const int kShowContended = 8;
+    auto contended = lock_contention(kShowContended);
+    if (!contended.empty()) {
+      printf("most contended entry locks:");
+      for (auto &p : contended) {
+        if (p.first.size() == sizeof(uint64_t)) { // integer keys
+          printf(" %lu(%u)", *(uint64_t *)p.first.data(), p.second);
+        } else {
+          printf(" %s(%u)", p.first.c_str(), p.second);
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  // keys of the current epoch whose entry locks were contended most often,
+  // with the number of contended acquisitions
+  std::vector<std::pair<std::string, uint32_t>> lock_contention(size_t n) {
+    // like an operation, so that the switch does not free the meta under it
+    auto &thread_meta = thread_meta_array[Topology::threadID()];
+    thread_meta.is_in_nap = true;
+    thread_meta.op_seq++;
+    mfence();
+
+    auto res = g_cur_meta->cn_view->contention(n);
+
+    thread_meta.is_in_nap = false;
+    return res;
   }
 };
 
 template <class T>
-Nap<T>::Nap(T *raw_index, int hot_cnt)
-    : raw_index(raw_index), hot_cnt(hot_cnt), shift_thread_is_ready(false) {
+Nap<T>::Nap(T *raw_index, int hot_cnt, DetectorType detector,
+            ShiftMode shift)
+    : raw_index(raw_index), detector_type(detector), hot_cnt(hot_cnt),
+      shift_mode(shift), shift_thread_is_ready(false) {
+
+#ifdef USE_GLOBAL_LOCK
+  // the global lock is held across steps, which a worker cannot do
+  shift_mode = SHIFT_DEDICATED;
+#endif
 
   init_pmdk_pool();
 
@@ -189,9 +624,30 @@ Nap<T>::Nap(T *raw_index, int hot_cnt)
     }
     cow_alloc = new CowAlloctor(cow_meta);
 
+    // stream large values to PM if that is faster on this machine
+    const size_t kScratchSize = 1024 * 1024;
+    pmemobj_alloc(Topology::pmdk_pool()->handle(), &oid, kScratchSize, 0,
+                  nullptr, nullptr);
+    nt_store_threshold = persistent::calibrate_nt_store(
+        (char *)pmemobj_direct(oid), kScratchSize);
+    pmemobj_free(&oid);
+    if (nt_store_threshold != (size_t)-1) {
+      printf("nap: non-temporal CoW stores from %lu bytes\n",
+             nt_store_threshold);
+    }
+
 #endif
   }
 
+  if (shift_mode != SHIFT_DEDICATED) {
+    shift_init();
+  }
+
+  if (shift_mode == SHIFT_COOPERATIVE) {
+    shift_thread_is_ready.store(true);
+    return;
+  }
+
   shift_thread = std::thread(&Nap<T>::nap_shift, this);
 
   while (!shift_thread_is_ready)
@@ -201,7 +657,17 @@ Nap<T>::Nap(T *raw_index, int hot_cnt)
 template <class T> Nap<T>::~Nap() {
   shift_thread_is_ready.store(false);
 
-  shift_thread.join();
+  if (shift_thread.joinable()) {
+    shift_thread.join();
+  }
+
+  while (shift.phase != SHIFT_POLL) { // a switch in progress
+    try_shift_step(0);
+  }
+
+  if (committer) {
+    delete committer;
+  }
 }
 
 template <class T> void Nap<T>::init_pmdk_pool() {
@@ -233,8 +699,11 @@ void Nap<T>::put(const Slice &key, const Slice &value, bool is_update) {
    
 
   // sampling and publish access pattern
-  if (thread_meta.op_seq % kSampleInterval == 0) {
-    CM->record(key);
+  sample(thread_meta, SAMPLE_WRITE, key);
+
+  if (bypassed.load(std::memory_order_relaxed)) { // see set_enabled
+    raw_index->put(key, value, is_update);
+    goto out;
   }
 
 retry:
@@ -265,22 +734,42 @@ retry:
 
     thread_meta.hit_in_cap++;
 
+    if (e->read_only) {
+      CNView::Entry *pre_e; // flushing its NAL slot may overwrite the write
+      if (pre_meta && pre_meta->cn_view->get_entry(key, pre_e) &&
+          !pre_e->read_only) {
+        wait_for_pre_meta(thread_meta);
+        goto retry;
+      }
+      if (!write_read_cache(pre_meta, e, key, value, is_update, false)) {
+        goto retry;
+      }
+      goto out;
+    }
+
+    if (e->combine != nullptr) {
+      if (!combine_put(cur_meta, pre_meta, e, key, value)) {
+        goto retry;
+      }
+      goto out;
+    }
+
     bool is_writer = false;
 
-    auto alloc_ptr = cur_meta->sp_view->alloc_before_update(key, value);
+    char *alloc_ptr = nullptr; // a group commit allocates by itself
+    if (durability != DURABILITY_RELAXED) {
+      alloc_ptr = cur_meta->sp_view->alloc_before_update(key, value);
+    }
 
-  re_lock:
-    if (!e->l.try_putLock(is_writer)) {
-      if (is_writer) { // two requests of the same key, one of which can b
-// returned directly after waiting for unlock.
+    if (!e->l.putLock(is_writer)) {
+      // two requests of the same key, one of which can be
+      // returned directly after waiting for unlock.
 #ifdef USE_GLOBAL_LOCK
-        shift_global_lock.read_unlock();
+      shift_global_lock.read_unlock();
 #endif
-        while (!e->l.is_unlock())
-          ;
-        return;
-      }
-      goto re_lock;
+      while (!e->l.is_unlock())
+        ;
+      return;
     }
 
     if (e->shifting) { // I am previous view, cannot update now
@@ -288,39 +777,12 @@ retry:
       goto retry;
     }
 
-    if (e->location == WhereIsData::IN_PREVIOUS_EPOCH) { //
-      CNView::Entry *pre_e;
-      if (pre_meta->cn_view->get_entry(key, pre_e)) {
-        pre_e->l.wLock();
-        pre_e->shifting = true;
-        pre_e->l.wUnlock();
-      } else {
-        assert(false);
-      }
-    }
-
-#ifdef GLOBAL_VERSION
-    cur_meta->sp_view->update(e->sp_view_index, alloc_ptr, key, value, 1);
-#else
-    cur_meta->sp_view->update(e->sp_view_index, alloc_ptr, key, value,
-                              e->next_version());
-#endif
-
-    e->v = value.ToString();
-    e->is_deleted = false;
-
-    if (e->location != WhereIsData::IN_CURRENT_EPOCH) {
-      e->location = WhereIsData::IN_CURRENT_EPOCH;
-    }
+    apply_put(cur_meta, pre_meta, e, key, value, alloc_ptr);
 
     e->l.putUnlock();
   } else if (pre_meta) {
     if (pre_meta->cn_view->get_entry(key, e)) { // in the pre_meta
-      thread_meta.is_in_nap = false;
-      while (g_pre_meta != nullptr) {
-        mfence();
-      }
-      thread_meta.is_in_nap = true;
+      wait_for_pre_meta(thread_meta);
       goto retry;
     } else {
       raw_index->put(key, value, is_update);
@@ -339,12 +801,83 @@ retry:
   
   }
 
+out:
   compiler_barrier();
   thread_meta.is_in_nap = false;
 
 #ifdef USE_GLOBAL_LOCK
   shift_global_lock.read_unlock();
 #endif
+  help_shift(thread_meta);
+}
+
+template <class T>
+void Nap<T>::apply_put(NapMeta *cur_meta, NapMeta *pre_meta, CNView::Entry *e,
+                       const Slice &key, const Slice &value,
+                       char *alloc_ptr) {
+  if (e->location == WhereIsData::IN_PREVIOUS_EPOCH) { //
+    CNView::Entry *pre_e;
+    if (pre_meta->cn_view->get_entry(key, pre_e)) {
+      pre_e->l.wLock();
+      pre_e->shifting = true;
+      pre_e->l.wUnlock();
+    } else {
+      assert(false);
+    }
+  }
+
+  if (!defer_update(cur_meta, e)) {
+    if (alloc_ptr == nullptr) {
+      alloc_ptr = cur_meta->sp_view->alloc_before_update(key, value);
+    }
+    cur_meta->sp_view->update(e->sp_view_index, alloc_ptr, key, value,
+                              e->next_version());
+  }
+
+  e->v = value.ToString();
+  e->is_deleted = false;
+  e->dirty = true;
+
+  if (e->location != WhereIsData::IN_CURRENT_EPOCH) {
+    e->location = WhereIsData::IN_CURRENT_EPOCH;
+  }
+}
+
+// Flat combining of the puts to a hot entry from one node: a put announces
+// its value in its node's slot of the entry, and whoever gets the entry
+// lock applies the newest value announced on its node, persisting it once
+// for all of them.  The other puts announced up to it return without
+// writing, as if overwritten right away, so the last writer still wins.
+// false if the entry is shifting and the put has to retry.
+template <class T>
+bool Nap<T>::combine_put(NapMeta *cur_meta, NapMeta *pre_meta,
+                         CNView::Entry *e, const Slice &key,
+                         const Slice &value) {
+  auto &slot = e->combine[Topology::numaIDOf(Topology::threadID())];
+  uint64_t ticket = slot.announce(value);
+
+  std::string latest;
+  uint32_t delay = 1;
+  while (slot.done.load(std::memory_order_acquire) < ticket) {
+    if (!e->l.try_wLock()) {
+      WRLock::backoff(delay);
+      continue;
+    }
+    delay = 1;
+
+    if (e->shifting) { // I am previous view, cannot update now
+      e->l.wUnlock();
+      return false;
+    }
+
+    uint64_t upto = slot.take(latest);
+    if (upto > slot.done.load(std::memory_order_relaxed)) {
+      apply_put(cur_meta, pre_meta, e, key, Slice(latest), nullptr);
+      slot.done.store(upto, std::memory_order_release);
+    }
+    e->l.wUnlock();
+  }
+  return true;
 }
 
 template <class T> bool Nap<T>::get(const Slice &key, std::string &value) {
@@ -356,15 +889,20 @@ template <class T> bool Nap<T>::get(const Slice &key, std::string &value) {
   thread_meta.op_seq++;
   
    // sampling and publish access pattern
-  if (thread_meta.op_seq % kSampleInterval == 0) {
-    CM->record(key);
-  }
+  sample(thread_meta, SAMPLE_READ, key);
 
   NapMeta *cur_meta, *pre_meta;
   uint64_t version, next_version, cur_epoch;
   next_version = 0;
 
   int count = 0;
+  bool res = true;
+
+  if (bypassed.load(std::memory_order_relaxed)) { // see set_enabled
+    res = raw_index->get(key, value);
+    goto out;
+  }
+
 retry:
   if (++count > 10000) {
     printf("exit with retry! %ld %ld\n", version, next_version);
@@ -388,7 +926,6 @@ retry:
 
   thread_meta.epoch = cur_epoch;
 
-  bool res = true;
   assert(cur_meta);
   CNView::Entry *e;
   if (cur_meta->cn_view->get_entry(key, e)) { // in the cur_meta
@@ -406,11 +943,13 @@ retry:
     res = raw_index->get(key, value); // in the raw index
   }
 
+out:
   compiler_barrier();
   thread_meta.is_in_nap = false;
 #ifdef USE_GLOBAL_LOCK
   shift_global_lock.read_unlock();
 #endif
+  help_shift(thread_meta);
   return res;
 }
 
@@ -484,14 +1023,7 @@ retry:
       goto retry;
     }
 
-    e->location = WhereIsData::IN_CURRENT_EPOCH;
-    res = raw_index->get(key, value);
-
-    if (res) {
-      e->v = value;
-    } else {
-      e->is_deleted = true;
-    }
+    res = load_from_raw_index(e, key, value);
     e->l.wUnlock();
   }
 
@@ -518,8 +1050,11 @@ template <class T> void Nap<T>::del(const Slice &key) {
   thread_meta.is_in_nap = true;
   thread_meta.op_seq++;
 
-  if (thread_meta.op_seq % kSampleInterval == 0) {
-    CM->record(key);
+  sample(thread_meta, SAMPLE_WRITE, key);
+
+  if (bypassed.load(std::memory_order_relaxed)) { // see set_enabled
+    raw_index->del(key);
+    goto out;
   }
 
 retry:
@@ -548,6 +1083,19 @@ retry:
 
     thread_meta.hit_in_cap++;
 
+    if (e->read_only) {
+      CNView::Entry *pre_e; // flushing its NAL slot may overwrite the write
+      if (pre_meta && pre_meta->cn_view->get_entry(key, pre_e) &&
+          !pre_e->read_only) {
+        wait_for_pre_meta(thread_meta);
+        goto retry;
+      }
+      if (!write_read_cache(pre_meta, e, key, value, false, true)) {
+        goto retry;
+      }
+      goto out;
+    }
+
     bool is_writer = false;
 
     e->l.wLock();
@@ -568,14 +1116,13 @@ retry:
       }
     }
 
-#ifdef GLOBAL_VERSION
-    cur_meta->sp_view->update(e->sp_view_index, nullptr, key, value, 1, true);
-#else
-    cur_meta->sp_view->update(e->sp_view_index, nullptr, key, value,
-                              e->next_version(), true);
-#endif
+    if (!defer_update(cur_meta, e)) {
+      cur_meta->sp_view->update(e->sp_view_index, nullptr, key, value,
+                                e->next_version(), true);
+    }
 
     e->is_deleted = true;
+    e->dirty = true;
 
     if (e->location != WhereIsData::IN_CURRENT_EPOCH) {
       e->location = WhereIsData::IN_CURRENT_EPOCH;
@@ -584,11 +1131,7 @@ retry:
     e->l.putUnlock();
   } else if (pre_meta) {
     if (pre_meta->cn_view->get_entry(key, e)) {
-      thread_meta.is_in_nap = false;
-      while (g_pre_meta != nullptr) {
-        mfence();
-      }
-      thread_meta.is_in_nap = true;
+      wait_for_pre_meta(thread_meta);
       goto retry;
     } else {
       raw_index->del(key);
@@ -609,12 +1152,52 @@ retry:
     // UNLOCK
   }
 
+out:
   compiler_barrier();
   thread_meta.is_in_nap = false;
 
 #ifdef USE_GLOBAL_LOCK
   shift_global_lock.read_unlock();
 #endif
+  help_shift(thread_meta);
+}
+
+// write through a read-only (DRAM-cached) hot key; false if the entry
+// belongs to a previous view, i.e., the caller has to retry.
+template <class T>
+bool Nap<T>::write_read_cache(NapMeta *pre_meta, CNView::Entry *e,
+                              const Slice &key, const Slice &value,
+                              bool is_update, bool is_del) {
+  e->l.wLock();
+  if (e->shifting) {
+    e->l.wUnlock();
+    return false;
+  }
+
+  // writers still in the previous epoch would write through the old entry
+  // after this write: make them retry in this epoch, as apply_put does
+  if (e->location == WhereIsData::IN_PREVIOUS_EPOCH) {
+    CNView::Entry *pre_e;
+    if (pre_meta->cn_view->get_entry(key, pre_e)) {
+      pre_e->l.wLock();
+      pre_e->shifting = true;
+      pre_e->l.wUnlock();
+    } else {
+      assert(false);
+    }
+  }
+
+  if (is_del) {
+    raw_index->del(key);
+  } else {
+    raw_index->put(key, value, is_update);
+    e->v = value.ToString();
+  }
+  e->is_deleted = is_del;
+  e->location = WhereIsData::IN_CURRENT_EPOCH;
+  e->l.wUnlock();
+
+  return true;
 }
 
 template <class T>
@@ -623,190 +1206,564 @@ void Nap<T>::range_query(const Slice &key, size_t count,
   // use ``internal_query`` for evaluation.
 }
 
-template <class T> void Nap<T>::nap_shift() {
+// poll access samples for ``seconds``; meanwhile, write back dirty NAL
+// entries of the current epoch in small batches.
+template <class T> void Nap<T>::poll_and_checkpoint(double seconds) {
+  const double kPollStep = 0.001; // seconds
 
-  static auto sort_func = [](const NapPair &a, const NapPair &b) {
-    return a.first < b.first;
-  };
+  if (kCheckpointInterval <= 0) {
+    CM->poll_workloads(seconds);
+    return;
+  }
+
+  uint64_t ns = seconds * (1000ull * 1000 * 1000);
+  Timer timer;
+  timer.begin();
+
+  uint64_t passed;
+  while ((passed = timer.end()) < ns) {
+    CM->poll_workloads(std::min(kPollStep, (ns - passed) / 1e9));
+
+    if (ckpt_cursor == 0) { // wait for the next checkpoint pass
+      if (ckpt_timer.end() < kCheckpointInterval * 1e9) {
+        continue;
+      }
+      ckpt_timer.begin();
+    }
 
-  bindCore(Topology::threadID());
+    ckpt_cursor =
+        g_cur_meta->checkpoint<T>(raw_index, ckpt_cursor, kCheckpointBatch);
+    if (ckpt_cursor >= g_cur_meta->sp_view->get_size()) {
+      ckpt_cursor = 0;
+    }
+  }
+}
 
-  CM = new CountMin(hot_cnt);
+// sample less if the detector falls behind while the hot set is clear;
+// sample more if the skew is ambiguous and there is headroom.
+template <class T> void Nap<T>::adapt_sampling(const std::vector<Node> &l) {
+  bool saturated = CM->is_saturated();
+  if (!adaptive_sampling) {
+    return;
+  }
+
+  bool ambiguous = l.size() <= 1 || l[1].cnt < 100 ||
+                   (l[1].cnt >= 3 * l.back().cnt && // not uniform
+                    l[1].cnt < 10 * l.back().cnt);  // nor clearly skewed
+
+  for (int i = 0; i < SAMPLE_TYPE_CNT; ++i) {
+    auto &v = kSampleInterval[i];
+    if (saturated && !ambiguous && v * 2 <= kMaxSampleInterval) {
+      v *= 2;
+    } else if (!saturated && ambiguous && v > 1) {
+      v /= 2;
+    }
+  }
+}
+
+template <class T> void Nap<T>::shift_init() {
+#ifdef NUMA_AGGREGATION
+  CM = new NumaAggregator(detector_type, hot_cnt);
+#else
+  CM = new_detector(detector_type, hot_cnt);
+#endif
 
   g_cur_epoch = 1;
   epoch_seq_lock = 0;
   g_cur_meta = g_pre_meta = g_gc_meta = nullptr;
 
-  std::vector<NapPair> cur_list;
-  g_cur_meta = new NapMeta(cur_list);
+  g_cur_meta = new NapMeta(shift.cur_list, {}, nullptr, nullptr,
+                           free_arena());
+
+  ckpt_timer.begin();
+  start_interval();
+}
+
+template <class T> void Nap<T>::nap_shift() {
+  const double kDedicatedPollSlice = 0.001;  // seconds
+  const double kBackgroundPollSlice = 0.0001; // seconds
+  const int kBackgroundSleepUs = 1000;
+
+  if (shift_mode == SHIFT_DEDICATED) {
+    bindCore(Topology::threadID());
+    shift_init();
+  } else { // SHIFT_BACKGROUND: run only on otherwise idle cores
+    sched_param param{0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  }
 
   shift_thread_is_ready.store(true);
 
   printf("shift thread finished init [%d].\n", Topology::threadID());
 
-  const int kPreHotest = 8;
-  std::string pre_hotest_keys[kPreHotest];
-  while (shift_thread_is_ready) {
+  // a switch in progress is finished before stopping
+  while (shift_thread_is_ready || shift.phase != SHIFT_POLL) {
+    if (shift_mode == SHIFT_DEDICATED) {
+      shift_step(kDedicatedPollSlice, true);
+    } else if (!try_shift_step(kBackgroundPollSlice, true) ||
+               shift.phase == SHIFT_POLL) {
+      usleep(kBackgroundSleepUs);
+    }
+  }
 
-    CM->reset(); // clear min-count sketch and min heap
-    CM->poll_workloads(kSwitchInterval /* seconds */);
+  printf("shift thread stopped.\n");
+}
 
-    auto &l = CM->get_list();
+template <class T> void Nap<T>::start_interval() {
+  // age min-count sketch and min heap instead of clearing them, so hot-set
+  // decisions depend on a decayed history rather than the last interval.
+  CM->decay();
+  shift.interval.begin();
+  shift.phase = SHIFT_POLL;
+}
 
-    std::sort(
-        l.begin() + 1, l.end(),
-        [](const nap::Node &a, const nap::Node &b) { return a.cnt > b.cnt; });
+// One step of the switch.  Each step does a bounded amount of work and
+// never waits: a phase that waits for other threads just returns until
+// they are done.  Deciding on the next hot set is not: only a step on the
+// shift thread does it, and without one, a preparer thread does it while
+// the steps wait in SHIFT_PREPARE.
+template <class T>
+void Nap<T>::shift_step(double poll_slice, bool on_shift_thread) {
+  const size_t kShiftBatch = 4096; // slots or entries per step
 
-    if (l.size() <= kPreHotest || l[1].cnt < 100) { // not need shift
-      continue;
-    }
+  switch (shift.phase) {
+  case SHIFT_POLL:
+    poll_and_checkpoint(poll_slice);
 
-    if (l[1].cnt / l.back().cnt < 3) { // it is a uniform workload
-      continue;
+    if (!want_enabled && (bypass == BYPASS_OFF || bypass == BYPASS_RESUMING)) {
+      bypass = BYPASS_DRAINING;
+      if (drain_epoch()) {
+        shift.phase = SHIFT_WAIT_EPOCH;
+      } else {
+        bypass_all();
+      }
+      break;
     }
 
-    bool need_shift = true;
-    for (int i = 0; i < kPreHotest; ++i) {
-      if (l[1].key == pre_hotest_keys[i]) {
-        need_shift = false;
-        break;
+    if (want_enabled && bypass == BYPASS_ON) {
+      bypassed.store(false);
+      mfence();
+      for (int i = 0; i < kMaxThreadCnt; ++i) {
+        shift.grace_seq[i] = thread_meta_array[i].op_seq;
       }
+      bypass = BYPASS_RESUMING;
+      start_interval();
+      break;
     }
 
-    if (!need_shift) {
-      continue;
+    if (shift.interval.end() < kSwitchInterval * 1e9) {
+      break;
+    }
+    if (on_shift_thread) {
+      if (switch_epoch()) {
+        shift.phase = SHIFT_WAIT_EPOCH;
+      } else {
+        start_interval();
+      }
+      break;
+    }
+    if (shift_mode == SHIFT_BACKGROUND) {
+      break; // left to the background thread
     }
 
-    // for (size_t i = 1; i < 10; ++i) {
-    //   auto k = *(uint64_t *)(l[i].key.c_str());
-    //   printf("%ld %d\n", k, l[i].cnt);
-    // }
-
-#ifdef USE_GLOBAL_LOCK
-    shift_global_lock.write_lock();
-#endif
+    // selecting the hot set and building its meta take milliseconds, too
+    // long for a step between a worker's operations
+    shift.prepared = false;
+    shift.preparer = std::thread([this] {
+      shift.next_meta = decide_epoch(shift.next_list);
+      shift.prepared.store(true, std::memory_order_release);
+    });
+    shift.phase = SHIFT_PREPARE;
+    break;
 
-    for (size_t i = 0; i < kPreHotest; ++i) {
-      pre_hotest_keys[i] = l[1 + i].key;
+  case SHIFT_PREPARE:
+    if (!shift.prepared.load(std::memory_order_acquire)) {
+      return;
     }
+    shift.preparer.join();
 
-    std::vector<NapPair> new_list;
-    for (uint64_t k = 1; k < l.size(); ++k) {
-      new_list.push_back({l[k].key, WhereIsData::IN_RAW_INDEX});
+    if (shift.next_meta == nullptr) {
+      start_interval();
+      break;
     }
-    
-    std::sort(new_list.begin(), new_list.end(), sort_func);
+    publish_epoch(shift.next_meta, shift.next_list);
+    shift.next_meta = nullptr;
+    shift.phase = SHIFT_WAIT_EPOCH;
+    break;
 
-    uint64_t overlapped_cnt = 0;
-    for (size_t i = 0, j = 0; i < cur_list.size() && j < new_list.size();) {
-      int cmp = cur_list[i].first.compare(new_list[j].first);
-      if (cmp == 0) { // overlapped kv in different epoch
-        new_list[j].second = WhereIsData::IN_PREVIOUS_EPOCH;
-        i++, j++;
-        overlapped_cnt++;
-      } else if (cmp < 0) {
-        i++;
-      } else {
-        j++;
+  case SHIFT_WAIT_EPOCH:
+    // wait util all threads learn that a shifting is ongoing.
+    for (int i = 0; i < kMaxThreadCnt; ++i) {
+      auto &m = thread_meta_array[i];
+      if (m.epoch != g_cur_epoch && m.is_in_nap) {
+        return;
       }
     }
 
-    if (overlapped_cnt > 0.75 * hot_cnt) { // not need shift
-      continue;
+    if (committer) { // pending group commits still target the old view
+      committer->hurry();
     }
+    start_warming();
+    shift.commit_ts = asm_rdtsc();
+    shift.phase = SHIFT_WAIT_COMMIT;
+    break;
 
-    auto new_meta = new NapMeta(new_list);
-    auto old_meta = g_cur_meta;
-
-    cur_list.swap(new_list);
-
-    undo_log->logging_type1(g_cur_meta, g_pre_meta); // undo logging
-    data_race_lock.write_lock();
-    epoch_seq_lock.fetch_add(1); 
-    g_cur_meta = new_meta;
-    // sleep(1);
-    g_pre_meta = old_meta;
-    // sleep(1);
-    g_cur_epoch++;
-    epoch_seq_lock.fetch_add(1);
-    data_race_lock.write_unlock();
-
-    persist_meta_ptrs();
-    undo_log->truncate();
+  case SHIFT_WAIT_COMMIT:
+    if (committer && !committer->is_durable(shift.commit_ts)) {
+      return;
+    }
+    shift.flush_cursor = 0;
+    shift.phase = SHIFT_FLUSH;
+    break;
 
-    // Timer timer;
-    // timer.begin();
+  case SHIFT_FLUSH: // flush the NAL into raw index
+    shift.flush_cursor = shift.old_meta->flush_sp_view(
+        raw_index, shift.flush_cursor, kShiftBatch);
+    if (shift.flush_cursor >= shift.old_meta->sp_view->get_size()) {
+      shift.relocate_cursor = shift.new_meta->cn_view->view.begin();
+      shift.phase = SHIFT_RELOCATE;
+    }
+    break;
 
-    // printf("new epoch %ld {%p}\n", g_cur_epoch.load(), g_cur_meta->sp_view);
+  case SHIFT_RELOCATE: // finish lazy initialization
+    shift.relocate_cursor = shift.new_meta->relocate_value(
+        shift.old_meta, shift.relocate_cursor, kShiftBatch);
+    if (shift.relocate_cursor == shift.new_meta->cn_view->view.end()) {
+      retire_epoch();
+      shift.phase = SHIFT_GRACE;
+    }
+    break;
 
-    // wait util all threads learn that a shifting is ongoing.
+  case SHIFT_GRACE:
+    // wait a grace period period for safe dealloction.
     for (int i = 0; i < kMaxThreadCnt; ++i) {
       auto &m = thread_meta_array[i];
-      while (m.epoch != g_cur_epoch && m.is_in_nap) {
-        mfence();
+      if (m.is_in_nap && m.op_seq == shift.grace_seq[i]) {
+        return;
       }
     }
 
-    // timer.end_print(1);
-    // timer.begin();
+    if (shift.warming > 0) {
+      return;
+    }
+    for (auto &th : shift.warmers) {
+      th.join();
+    }
+    shift.warmers.clear();
+    shift.warm_keys.clear();
+
+    delete shift.old_meta;
+    shift.old_meta = shift.new_meta = nullptr;
+    g_gc_meta = nullptr;
+    persist_meta_ptrs();
 
-    // printf("epoch %ld flush sp view\n", g_cur_epoch.load());
-    old_meta->flush_sp_view<T>(raw_index); // flush the NAL into raw index
+#ifdef USE_GLOBAL_LOCK
+    shift_global_lock.write_unlock();
+#endif
+    // printf("delete meta of epoch %ld safely\n", g_cur_epoch - 1);
+    if (bypass == BYPASS_DRAINING) {
+      bypass_all();
+    }
+    start_interval();
+    break;
+  }
+}
 
-    // timer.end_print(1);
-    // timer.begin();
+// decide on the hot set of the next epoch and publish it (phase 1 of the
+// switch); false if the current one is good enough.
+template <class T> bool Nap<T>::switch_epoch() {
+  std::vector<NapPair> new_list;
+  auto *new_meta = decide_epoch(new_list);
+  if (new_meta == nullptr) {
+    return false;
+  }
 
-    // printf("epoch %ld relocate_value\n", g_cur_epoch.load());
-    new_meta->relocate_value(old_meta); // finish lazy initialization
+  publish_epoch(new_meta, new_list);
+  return true;
+}
 
-    // timer.end_print(1);
-    // timer.begin();
+// at the end of a polling interval: the meta of the next epoch, or nullptr
+// if there is none yet.  Nothing else runs the switch meanwhile.
+template <class T>
+NapMeta *Nap<T>::decide_epoch(std::vector<NapPair> &new_list) {
+  if (bypass != BYPASS_OFF && !resume_from_bypass()) {
+    return nullptr;
+  }
+  return prepare_epoch(new_list);
+}
 
-    compiler_barrier();
+// the meta of the next hot set, of keys ``new_list``; nullptr if the current
+// one is good enough.
+template <class T>
+NapMeta *Nap<T>::prepare_epoch(std::vector<NapPair> &new_list) {
+  Timer timer;
+  timer.begin();
 
-    auto del_meta = g_pre_meta;
+  auto l = hot_list();
 
-    undo_log->logging_type2(g_gc_meta, g_pre_meta);
-    epoch_seq_lock.fetch_add(1);
-    g_gc_meta = g_pre_meta;
-    g_pre_meta = nullptr;
-    epoch_seq_lock.fetch_add(1);
+  adapt_sampling(l);
 
-    persist_meta_ptrs();
-    undo_log->truncate();
+  if (!is_skewed(l)) {
+    return nullptr;
+  }
 
-    // timer.end_print(1);
+  bool need_shift = true;
+  for (int i = 0; i < kPreHotest; ++i) {
+    if (l[1].key == shift.pre_hotest_keys[i]) {
+      need_shift = false;
+      break;
+    }
+  }
 
-    // printf("-----------%ld-----------\n", g_cur_epoch.load());
+  if (!need_shift) {
+    return nullptr;
+  }
 
-    // wait a grace period period for safe dealloction.
-    for (int i = 0; i < kMaxThreadCnt; ++i) {
-      auto &m = thread_meta_array[i];
-      auto cur_seq = m.op_seq;
+  // for (size_t i = 1; i < 10; ++i) {
+  //   auto k = *(uint64_t *)(l[i].key.c_str());
+  //   printf("%ld %d\n", k, l[i].cnt);
+  // }
 
-    retry:
-      if (!m.is_in_nap) {
-        continue;
-      }
-      if (m.op_seq != cur_seq) {
-        continue;
-      }
+#ifdef USE_GLOBAL_LOCK
+  shift_global_lock.write_lock();
+#endif
 
-      mfence();
-      goto retry;
+  for (size_t i = 0; i < kPreHotest; ++i) {
+    shift.pre_hotest_keys[i] = l[1 + i].key;
+  }
+
+  new_list.clear();
+  std::unordered_set<std::string> read_hot;
+  std::unordered_map<std::string, int> home_of;
+  SlotHeatMap heat;
+  for (uint64_t k = 1; k < l.size(); ++k) {
+    new_list.push_back({l[k].key, WhereIsData::IN_RAW_INDEX});
+    if (kReadCacheWriteShare >= 0 && is_read_only(l[k])) {
+      read_hot.insert(l[k].key);
+      continue;
     }
 
-    delete del_meta;
-    g_gc_meta = nullptr;
-    persist_meta_ptrs();
+    if (home_node_of(l[k]) >= 0) {
+      home_of[l[k].key] = home_node_of(l[k]);
+    }
+    if (xpline_placement) {
+      heat[l[k].key] = {l[k].home_node, l[k].write_cnt};
+    }
+  }
+  
+  shift.warm_keys.clear();
+  for (uint64_t k = 1; k < l.size(); ++k) {
+    shift.warm_keys.push_back(l[k].key);
+  }
 
+  // overlapped kv in different epoch; the current CNView hashes the current
+  // hot set, so neither set has to be sorted to merge them
+  uint64_t overlapped_cnt = 0;
+  for (auto &p : new_list) {
+    if (g_cur_meta->cn_view->contains(p.first)) {
+      p.second = WhereIsData::IN_PREVIOUS_EPOCH;
+      overlapped_cnt++;
+    }
+  }
+
+  select_ns += timer.end();
+  select_cnt++;
+
+  if (overlapped_cnt > 0.75 * hot_cnt) { // not need shift
 #ifdef USE_GLOBAL_LOCK
     shift_global_lock.write_unlock();
 #endif
-    // printf("delete meta of epoch %ld safely\n", g_cur_epoch - 1);
+    return nullptr;
   }
 
-  printf("shift thread stopped.\n");
+  // only write-hot keys need a NAL slot to absorb their writes, and keys
+  // written from one node need it on that node only
+  std::vector<NapPair> write_list, read_list;
+  std::vector<NapPair> home_list[Topology::kNumaCnt];
+  for (auto &p : new_list) {
+    auto it = home_of.find(p.first);
+    if (read_hot.count(p.first)) {
+      read_list.push_back(p);
+    } else if (it != home_of.end()) {
+      home_list[it->second].push_back(p);
+    } else {
+      write_list.push_back(p);
+    }
+  }
+
+  auto new_meta = new NapMeta(write_list, read_list, home_list,
+                              xpline_placement ? &heat : nullptr,
+                              free_arena());
+  {
+    std::vector<std::string> hottest;
+    size_t hottest_cnt = std::max(kNodeReaderKeys, kCombiningKeys);
+    for (size_t k = 1; k < l.size() && hottest.size() < hottest_cnt; ++k) {
+      hottest.push_back(l[k].key);
+    }
+    new_meta->cn_view->enable_node_readers(hottest, kNodeReaderKeys);
+    new_meta->cn_view->enable_combining(hottest, kCombiningKeys);
+  }
+
+  return new_meta;
+}
+
+// the detector's top-N keys: the hottest of them first and in order, as
+// far as the switch uses the order, and the coldest one last
+template <class T> std::vector<Node> Nap<T>::hot_list() {
+  auto l = CM->get_list(); // a copy: selecting would break the heap
+
+  select_hottest(l, std::max({(size_t)kPreHotest, kNodeReaderKeys,
+                              kCombiningKeys, kOrderedHotKeys}));
+  return l;
+}
+
+template <class T> bool Nap<T>::is_skewed(const std::vector<Node> &l) {
+  if (l.size() <= kPreHotest || l[1].cnt < 100) { // not need shift
+    return false;
+  }
+
+  if (l[1].cnt < 3 * l.back().cnt) { // it is a uniform workload
+    return false;
+  }
+
+  return true;
+}
+
+// make ``new_meta``, of keys ``new_list``, the current one and the current
+// one the previous one
+template <class T>
+void Nap<T>::publish_epoch(NapMeta *new_meta, std::vector<NapPair> &new_list) {
+  auto old_meta = g_cur_meta;
+
+  shift.cur_list.swap(new_list);
+  ckpt_cursor = 0; // restart checkpointing on the new epoch
+
+  undo_log->logging_type1(g_cur_meta, g_pre_meta); // undo logging
+  data_race_lock.write_lock();
+  epoch_seq_lock.fetch_add(1); 
+  g_cur_meta = new_meta;
+  // sleep(1);
+  g_pre_meta = old_meta;
+  // sleep(1);
+  g_cur_epoch++;
+  epoch_seq_lock.fetch_add(1);
+  data_race_lock.write_unlock();
+
+  persist_meta_ptrs();
+  undo_log->truncate();
+
+  shift.old_meta = old_meta;
+  shift.new_meta = new_meta;
+}
+
+// publish an empty hot set, so that the switch flushes the NAL into the raw
+// index; false if it is empty already.
+template <class T> bool Nap<T>::drain_epoch() {
+  for (auto &k : shift.pre_hotest_keys) { // so that the same keys come back
+    k.clear();
+  }
+
+  if (shift.cur_list.empty()) {
+    return false;
+  }
+
+#ifdef USE_GLOBAL_LOCK
+  shift_global_lock.write_lock();
+#endif
+
+  std::vector<NapPair> empty_list;
+  publish_epoch(new NapMeta(empty_list, {}, nullptr, nullptr, free_arena()),
+                empty_list);
+  return true;
+}
+
+// at the end of a polling interval while bypassed or resuming; true once
+// Nap serves again and may switch to a new hot set
+template <class T> bool Nap<T>::resume_from_bypass() {
+  if (bypass == BYPASS_ON) {
+    auto l = hot_list();
+    adapt_sampling(l);
+    if (auto_enable && is_skewed(l)) {
+      want_enabled = true;
+    }
+    return false; // the step re-enables Nap, see shift_step
+  }
+
+  // BYPASS_RESUMING: bypassed operations started before the flag was
+  // cleared must be over before any value is loaded into a CNView; an
+  // interval after clearing it, their ``is_in_nap`` is visible
+  for (int i = 0; i < kMaxThreadCnt; ++i) {
+    auto &m = thread_meta_array[i];
+    if (m.is_in_nap && m.op_seq < shift.grace_seq[i] + 2) {
+      return false;
+    }
+  }
+
+  bypass = BYPASS_OFF;
+  return true;
+}
+
+// once every thread uses the new epoch, so that none of them writes a new hot
+// key to the raw index any more: load the new hot keys from the raw index in
+// the background, hottest first, rather than in the critical section of
+// their first reader.  Joined before the switch ends.
+template <class T> void Nap<T>::start_warming() {
+  int cnt = kWarmThreads;
+  if (cnt <= 0 || shift.warm_keys.empty()) {
+    return;
+  }
+
+  shift.warming = cnt;
+  for (int i = 0; i < cnt; ++i) {
+    shift.warmers.emplace_back(&Nap<T>::warm, this, shift.new_meta, i, cnt);
+  }
+}
+
+// warmer ``id`` of ``cnt`` takes every cnt-th key
+template <class T> void Nap<T>::warm(NapMeta *meta, int id, int cnt) {
+  Topology::setThreadID(Topology::warmerID(id));
+  if (thread_init) {
+    thread_init(Topology::warmerID(id));
+  }
+  bindNode(id); // best effort
+
+  std::string value;
+  for (size_t i = id; i < shift.warm_keys.size(); i += cnt) {
+    Slice key(shift.warm_keys[i]);
+    CNView::Entry *e;
+    if (!meta->cn_view->get_entry(key, e)) {
+      continue;
+    }
+
+    if (!e->l.try_wLock()) { // its reader or writer is loading it
+      continue;
+    }
+    if (e->location == WhereIsData::IN_RAW_INDEX) {
+      load_from_raw_index(e, key, value);
+    }
+    e->l.wUnlock();
+  }
+
+  shift.warming.fetch_sub(1);
+}
+
+// the previous NAL is flushed: retire its meta (phase 3 of the switch), to
+// be freed after a grace period.
+template <class T> void Nap<T>::retire_epoch() {
+  compiler_barrier();
+
+  undo_log->logging_type2(g_gc_meta, g_pre_meta);
+  epoch_seq_lock.fetch_add(1);
+  g_gc_meta = g_pre_meta;
+  g_pre_meta = nullptr;
+  epoch_seq_lock.fetch_add(1);
+
+  persist_meta_ptrs();
+  undo_log->truncate();
+
+  for (int i = 0; i < kMaxThreadCnt; ++i) {
+    shift.grace_seq[i] = thread_meta_array[i].op_seq;
+  }
 }
 
 } // namespace nap
@@ -6,6 +6,8 @@
 
 #define FIX_8_BYTE_VALUE
 // #define SUPPORT_RANGE
+// #define NUMA_AGGREGATION // per-NUMA aggregator threads pre-aggregate samples
+// #define LOG_STRUCTURED_NAL // per-thread append-only logs as the PC-View
 
 namespace nap {
 
@@ -18,6 +20,7 @@ enum WhereIsData : char {
 using NapPair = std::pair<std::string, WhereIsData>;
 
 constexpr int kCachelineSize = 64;
+constexpr int kXPLineSize = 256; // media access granularity of Optane
 constexpr int kMaxNumaCnt = 8;
 constexpr int kMaxThreadCnt = 80;
 
@@ -26,6 +29,10 @@ constexpr int kHotKeys = 100000;
 class CowAlloctor;
 extern CowAlloctor *cow_alloc;
 
+// CoW values of at least this size are streamed to PM with non-temporal
+// stores; calibrated at startup, see Nap::set_nt_store_threshold to override
+extern size_t nt_store_threshold;
+
 
 inline void mfence() { asm volatile("mfence\n" : : : "memory"); }
 
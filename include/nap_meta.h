@@ -2,26 +2,137 @@
 #define _NAP_META_H_
 
 #include "cn_view.h"
+#include "log_view.h"
 #include "sp_view.h"
 
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+
 namespace nap
 {
 
+#ifdef LOG_STRUCTURED_NAL
+using PCView = LogView;
+#else
+using PCView = SPView;
+#endif
+
+// write heat of a hot key, used to place its PC-View slot
+struct SlotHeat {
+	int node; // the node writing it most, -1 if unknown
+	int write_cnt;
+};
+
+using SlotHeatMap = std::unordered_map<std::string, SlotHeat>;
+
+// XPLine-aware placement.  Optane writes its media in 256B XPLines, so a
+// lone 64B slot update costs a 256B read-modify-write.  Keys written from
+// the same node are kept contiguous, the most written first, so co-written
+// slots share XPLines and are combined in the XPBuffer.
+inline void
+place_by_write_heat(std::vector<NapPair>::iterator begin,
+		    std::vector<NapPair>::iterator end, const SlotHeatMap &heat)
+{
+	struct Placed {
+		unsigned node; // -1 sorts last
+		int write_cnt;
+		NapPair *p;
+	};
+
+	std::vector<Placed> order;
+	for (auto it = begin; it != end; ++it) {
+		auto h = heat.find(it->first);
+		if (h == heat.end()) {
+			order.push_back({(unsigned)-1, 0, &*it});
+		} else {
+			order.push_back({(unsigned)h->second.node,
+					 h->second.write_cnt, &*it});
+		}
+	}
+
+	std::stable_sort(order.begin(), order.end(),
+			 [](const Placed &a, const Placed &b) {
+				 if (a.node != b.node) {
+					 return a.node < b.node;
+				 }
+				 return a.write_cnt > b.write_cnt;
+			 });
+
+	std::vector<NapPair> placed;
+	placed.reserve(order.size());
+	for (auto &e : order) {
+		placed.push_back(std::move(*e.p));
+	}
+	std::move(placed.begin(), placed.end(), begin);
+}
+
+// The memory of one NapMeta, kept for the meta after next: the CNView
+// entries in DRAM and the PC-View arrays and key blobs in PM.  At most two
+// metas are alive, the current one and the one being flushed or retired,
+// so two arenas let every switch reuse the memory of the meta retired by
+// the previous one.
+struct MetaArena {
+	CNView::Arena dram;
+	PCView::Arena pm;
+	bool in_use;
+
+	MetaArena(): in_use(false)
+	{
+	}
+};
+
 struct NapMeta {
 	CNView *cn_view;
-	SPView *sp_view;
+	PCView *sp_view;
+	MetaArena *arena;
 	// TODO bloom filter
 
-	NapMeta(): cn_view(nullptr), sp_view(nullptr)
+	NapMeta(): cn_view(nullptr), sp_view(nullptr), arena(nullptr)
 	{
 	}
 
-	NapMeta(std::vector<NapPair> &_list)
+	// ``read_list``: read-hot keys, cached in DRAM without a PC-View slot;
+	// ``home_list[n]``: keys written from node n only, with a slot there;
+	// ``heat``: place slots by write heat instead of randomly;
+	// ``arena``: a free one to take the memory from, if any.
+	NapMeta(std::vector<NapPair> &_list,
+		const std::vector<NapPair> &read_list = {},
+		const std::vector<NapPair> *home_list = nullptr,
+		const SlotHeatMap *heat = nullptr, MetaArena *arena = nullptr)
+		: arena(arena)
 	{
         auto list = _list;
-		std::random_shuffle(list.begin(), list.end());
-		cn_view = new CNView(list);
-		sp_view = new SPView(list);
+		place(list.begin(), list.end(), heat);
+
+		std::vector<size_t> home_cnt;
+		for (int n = 0; home_list && n < Topology::kNumaCnt; ++n) {
+			auto begin = list.size();
+			list.insert(list.end(), home_list[n].begin(),
+				    home_list[n].end());
+			place(list.begin() + begin, list.end(), heat);
+			home_cnt.push_back(home_list[n].size());
+		}
+
+		if (arena) {
+			assert(!arena->in_use);
+			arena->in_use = true;
+		}
+		cn_view = new CNView(list, read_list,
+				     arena ? &arena->dram : nullptr);
+		sp_view = new PCView(list, home_cnt,
+				     arena ? &arena->pm : nullptr);
+	}
+
+	static void
+	place(std::vector<NapPair>::iterator begin,
+	      std::vector<NapPair>::iterator end, const SlotHeatMap *heat)
+	{
+		if (heat) {
+			place_by_write_heat(begin, end, *heat);
+		} else {
+			std::random_shuffle(begin, end);
+		}
 	}
 
 	~NapMeta() {
@@ -31,6 +142,9 @@ struct NapMeta {
 		if (sp_view) {
 			delete sp_view;
 		}
+		if (arena) {
+			arena->in_use = false;
+		}
 	}
 
 	template <class T>
@@ -40,11 +154,59 @@ struct NapMeta {
 		sp_view->flush_to_raw_index<T>(raw_index);
 	}
 
+	// flush slots [begin, begin + batch); returns where the next batch
+	// starts.
+	template <class T>
+	size_t
+	flush_sp_view(T *raw_index, size_t begin, size_t batch)
+	{
+		size_t end = std::min(begin + batch, sp_view->get_size());
+		sp_view->flush_to_raw_index<T>(raw_index, begin, end);
+		return end;
+	}
+
+	// incrementally write back dirty NAL entries of the current epoch,
+	// starting at slot ``begin``; returns where the next batch starts.
+	template <class T>
+	size_t
+	checkpoint(T *raw_index, size_t begin, size_t batch)
+	{
+		size_t end = std::min(begin + batch, sp_view->get_size());
+		std::string value;
+		for (size_t i = begin; i < end; ++i) {
+			auto e = cn_view->entry_at(i);
+			if (!e->dirty) {
+				continue;
+			}
+
+			uint64_t ver;
+			bool is_del;
+			e->l.rLock();
+			e->dirty = false;
+			bool has_value =
+				sp_view->load_latest(i, ver, value, is_del);
+			e->l.rUnlock();
+
+			if (has_value && !sp_view->is_flushed(i, ver)) {
+				sp_view->write_back<T>(raw_index, i, ver, value,
+						       is_del);
+			}
+		}
+
+		return end;
+	}
+
 	void
 	relocate_value(NapMeta *old_meta)
 	{
         cn_view->relocate_value(old_meta->cn_view);
 	}
+
+	CNView::Cursor
+	relocate_value(NapMeta *old_meta, CNView::Cursor from, size_t batch)
+	{
+		return cn_view->relocate_value(old_meta->cn_view, from, batch);
+	}
 };
 } // namespace nap
 
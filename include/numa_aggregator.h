@@ -0,0 +1,174 @@
+#if !defined(_NUMA_AGGREGATOR_H_)
+#define _NUMA_AGGREGATOR_H_
+
+#include "hot_key_detector.h"
+#include "nap_common.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace nap {
+
+// Per-NUMA pre-aggregation of access samples: each node runs an aggregator
+// that drains only its local threads' record rings into a node-local
+// detector.  The shift thread merges the per-node top-k lists, so detection
+// capacity grows with the number of sockets.
+class NumaAggregator : public HotKeyDetector {
+private:
+  constexpr static double kPollStep = 0.001; // seconds
+
+  struct alignas(kCachelineSize) Stage {
+    HotKeyDetector *cm;
+    std::thread th;
+    std::atomic<uint64_t> snapshot_served;
+    std::atomic<uint64_t> decay_served;
+    std::atomic<uint64_t> reset_served;
+    std::vector<Node> snapshot;
+
+    Stage()
+        : cm(nullptr), snapshot_served(0), decay_served(0), reset_served(0) {}
+  };
+
+  int hot_keys_cnt;
+  Stage stages[Topology::kNumaCnt];
+
+  std::atomic<uint64_t> snapshot_req;
+  std::atomic<uint64_t> decay_req;
+  std::atomic<uint64_t> reset_req;
+  std::atomic_bool running;
+
+  std::vector<Node> list;
+
+  void aggregate(int node) {
+    // see Topology::setHelperCore for where aggregators run
+    bindHelper(Topology::HELPER_AGGREGATOR, node);
+
+    auto &stage = stages[node];
+    while (running.load(std::memory_order_relaxed)) {
+      stage.cm->poll_workloads(kPollStep);
+
+      uint64_t r = snapshot_req.load(std::memory_order_acquire);
+      if (r != stage.snapshot_served.load(std::memory_order_relaxed)) {
+        auto &l = stage.cm->get_list();
+        stage.snapshot.assign(l.begin() + 1, l.end());
+        stage.snapshot_served.store(r, std::memory_order_release);
+      }
+
+      r = decay_req.load(std::memory_order_acquire);
+      if (r != stage.decay_served.load(std::memory_order_relaxed)) {
+        stage.cm->decay();
+        stage.decay_served.store(r, std::memory_order_release);
+      }
+
+      r = reset_req.load(std::memory_order_acquire);
+      if (r != stage.reset_served.load(std::memory_order_relaxed)) {
+        stage.cm->reset();
+        stage.reset_served.store(r, std::memory_order_release);
+      }
+    }
+  }
+
+public:
+  NumaAggregator(DetectorType type, int hot_keys_cnt)
+      : hot_keys_cnt(hot_keys_cnt), snapshot_req(0), decay_req(0),
+        reset_req(0), running(true) {
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      int begin = n * Topology::kCorePerNuma;
+      int end = n == Topology::kNumaCnt - 1
+                    ? kMaxThreadCnt
+                    : begin + Topology::kCorePerNuma;
+      stages[n].cm = new_detector(type, hot_keys_cnt, begin, end);
+    }
+
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      stages[n].th = std::thread(&NumaAggregator::aggregate, this, n);
+    }
+  }
+
+  ~NumaAggregator() {
+    running.store(false);
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      stages[n].th.join();
+      delete stages[n].cm;
+    }
+  }
+
+  void record(const Slice &key, bool is_write) override {
+    int node = Topology::numaIDOf(Topology::threadID());
+    stages[node].cm->record(key, is_write);
+  }
+
+  // aggregators drain the rings by themselves; just wait
+  void poll_workloads(double seconds) override {
+    usleep(seconds * 1000 * 1000);
+  }
+
+  void decay() override { decay_req.fetch_add(1, std::memory_order_release); }
+
+  void reset() override { reset_req.fetch_add(1, std::memory_order_release); }
+
+  uint64_t dropped_samples() override {
+    uint64_t res = 0;
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      res += stages[n].cm->dropped_samples();
+    }
+    return res;
+  }
+
+  bool is_saturated() override {
+    bool res = false;
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      res |= stages[n].cm->is_saturated();
+    }
+    return res;
+  }
+
+  // merge per-node top-k lists by summing counts; slot 0 is a fence
+  std::vector<Node> &get_list() override {
+    uint64_t r = snapshot_req.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    list.clear();
+    list.push_back({"FENCE_KEY", 0});
+
+    std::unordered_map<std::string, size_t> pos; // key => position in list
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      auto &stage = stages[n];
+      while (stage.snapshot_served.load(std::memory_order_acquire) != r) {
+        mfence();
+      }
+
+      for (auto &node : stage.snapshot) {
+        auto it = pos.emplace(node.key, list.size());
+        if (it.second) {
+          list.push_back(Node(node.key, 0));
+        }
+
+        auto &m = list[it.first->second];
+        m.cnt += node.cnt;
+        m.write_cnt += node.write_cnt;
+        if (node.cnt > m.home_cnt) { // a stage samples its own node only
+          m.home_node = n;
+          m.home_cnt = node.cnt;
+        }
+      }
+    }
+
+    if ((int)list.size() > hot_keys_cnt + 1) {
+      std::nth_element(
+          list.begin() + 1, list.begin() + 1 + hot_keys_cnt, list.end(),
+          [](const Node &a, const Node &b) { return a.cnt > b.cnt; });
+      list.erase(list.begin() + 1 + hot_keys_cnt, list.end());
+    }
+
+    return list;
+  }
+};
+
+} // namespace nap
+
+#endif // _NUMA_AGGREGATOR_H_
@@ -2,12 +2,18 @@
 #define _NVM_H_
 
 #include <emmintrin.h>
+#include <immintrin.h>
 #include <stdint.h>
 #include <string.h>
+#include <x86intrin.h>
 #include <xmmintrin.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cpuid.h>
 #include <fcntl.h>
+#include <fstream>
+#include <glob.h>
 #include <string.h>
 #include <string>
 #include <sys/mman.h>
@@ -42,19 +48,122 @@ inline char *alloc_dram(size_t size) {
   return (char *)pmem;
 }
 
+// Where stores become persistent decides what a persist point has to do:
+// with ADR, only the memory controller is persistent and dirty lines must be
+// written back; with eADR the caches are too, so ordering stores is enough;
+// on DRAM-emulated PM nothing is persistent anyway.
+enum PersistMode {
+  PERSIST_FLUSH, // ADR: write back cache lines, then fence
+  PERSIST_FENCE, // eADR: fence only
+  PERSIST_NONE,  // emulated PM: no-op
+};
+
+enum FlushInsn {
+  FLUSH_CLWB,
+  FLUSH_CLFLUSHOPT,
+  FLUSH_CLFLUSH,
+};
+
+struct PersistPolicy {
+  PersistMode mode;
+  FlushInsn insn; // the cheapest write-back the CPU has
+};
+
+inline PersistMode persist_mode_of(const std::string &name,
+                                   PersistMode fallback) {
+  if (name == "flush" || name == "adr") {
+    return PERSIST_FLUSH;
+  }
+  if (name == "fence" || name == "eadr") {
+    return PERSIST_FENCE;
+  }
+  if (name == "none" || name == "emulated") {
+    return PERSIST_NONE;
+  }
+  return fallback;
+}
+
+// the persistence domain the platform reports for its PM regions, if any
+inline PersistMode detect_persist_mode() {
+  glob_t g;
+  if (glob("/sys/bus/nd/devices/region*/persistence_domain", 0, nullptr,
+           &g) != 0) {
+    return PERSIST_FLUSH; // unknown: be safe
+  }
+
+  bool eadr = g.gl_pathc > 0;
+  for (size_t i = 0; i < g.gl_pathc; ++i) {
+    std::ifstream f(g.gl_pathv[i]);
+    std::string domain;
+    f >> domain;
+    eadr &= domain == "cpu_cache";
+  }
+  globfree(&g);
+  return eadr ? PERSIST_FENCE : PERSIST_FLUSH;
+}
+
+// CPUID picks the flush instruction; NAP_PERSIST=flush|fence|none
+// overrides the persistence domain of the platform.
+//
+// Only NAP's own flushes and those of the raw indexes that ask
+// ``flush_needed()`` follow the policy.  PMDK decides for its persist()
+// from PMEM_NO_FLUSH when libpmem is loaded, before any of this runs, so
+// on eADR set PMEM_NO_FLUSH=1 in the environment the program is launched
+// with.
+inline PersistPolicy make_persist_policy() {
+  PersistPolicy p;
+
+  unsigned a, b, c, d;
+  __cpuid_count(7, 0, a, b, c, d);
+  p.insn = (b & (1u << 24))   ? FLUSH_CLWB
+           : (b & (1u << 23)) ? FLUSH_CLFLUSHOPT
+                              : FLUSH_CLFLUSH;
+
+  const char *conf = getenv("NAP_PERSIST");
+  p.mode = conf ? persist_mode_of(conf, PERSIST_FLUSH) : detect_persist_mode();
+  return p;
+}
+
+inline PersistPolicy persist_policy = make_persist_policy();
+
+// e.g., from a configuration file; PMDK is not affected, see above
+inline void set_persist_mode(PersistMode mode) { persist_policy.mode = mode; }
+
+inline bool flush_needed() { return persist_policy.mode == PERSIST_FLUSH; }
+
+// write back and invalidate; ordered with other stores, needs no fence
 inline void clflush(void *addr) {
+  if (!flush_needed()) {
+    return;
+  }
   asm volatile("clflush %0" : "+m"(*(volatile char *)(addr)));
 }
 
+// write back, the cheapest way the CPU can; needs a fence
 inline void clwb(void *addr) {
-  asm volatile(".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)(addr)));
+  if (!flush_needed()) {
+    return;
+  }
+  switch (persist_policy.insn) {
+  case FLUSH_CLWB:
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *)(addr)));
+    break;
+  case FLUSH_CLFLUSHOPT:
+    asm volatile(".byte 0x66; clflush %0" : "+m"(*(volatile char *)(addr)));
+    break;
+  default:
+    asm volatile("clflush %0" : "+m"(*(volatile char *)(addr)));
+  }
 }
 
-inline void clflushopt(void *addr) {
-  asm volatile(".byte 0x66; clflush %0" : "+m"(*(volatile char *)(addr)));
-}
+inline void clflushopt(void *addr) { clwb(addr); }
 
-inline void persistent_barrier() { asm volatile("sfence\n" : :); }
+inline void persistent_barrier() {
+  if (persist_policy.mode == PERSIST_NONE) {
+    return;
+  }
+  asm volatile("sfence\n" : :);
+}
 
 inline void mfence() { asm volatile("mfence\n" : :); }
 
@@ -76,6 +185,15 @@ inline void clwb_range(void *des, size_t size) {
   persistent_barrier();
 }
 
+// as ``clwb_range``, but the caller fences, e.g., once for a batch
+inline void clwb_range_nofence(void *des, size_t size) {
+  char *addr = (char *)des;
+  size = size + ((uint64_t)(addr) & (kCachelineSize - 1));
+  for (size_t i = 0; i < size; i += kCachelineSize) {
+    clwb(addr + i);
+  }
+}
+
 inline void clflushopt_range(void *des, size_t size) {
   char *addr = (char *)des;
   size = size + ((uint64_t)(addr) & (kCachelineSize - 1));
@@ -157,6 +275,94 @@ inline void nt_copy(void *dst, void *src, int size) {
                        : "memory");
 }
 
+// copy to PM with non-temporal (streaming) stores, which bypass the cache
+// instead of pulling lines in only to flush them again; the unaligned head
+// and tail are stored normally and written back.  The caller fences.
+inline void nt_store_range(void *des, const void *src, size_t size) {
+  char *d = (char *)des;
+  const char *s = (const char *)src;
+
+  if (persist_policy.mode == PERSIST_NONE) {
+    memcpy(d, s, size);
+    return;
+  }
+
+  size_t head = std::min(size, (size_t)(-(uintptr_t)d & 31));
+  if (head) {
+    memcpy(d, s, head);
+    clwb(d);
+    d += head, s += head, size -= head;
+  }
+
+#ifdef __AVX__
+  for (; size >= 32; d += 32, s += 32, size -= 32) {
+    _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+  }
+#else
+  for (; size >= 16; d += 16, s += 16, size -= 16) {
+    _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+  }
+#endif
+
+  if (size) {
+    memcpy(d, s, size);
+    clwb(d);
+  }
+}
+
+// the smallest store size from which ``nt_store_range`` persists faster than
+// memcpy + ``clflushopt_range`` on ``scratch`` (PM of at least 1MB); -1 if
+// it never does.  Both paths are warmed up first, then each size takes the
+// best of several runs, alternating which path goes first.  Takes a few tens
+// of milliseconds.
+inline size_t calibrate_nt_store(char *scratch, size_t scratch_size) {
+  const size_t kSizes[] = {64, 128, 256, 512, 1024, 2048, 4096};
+  const size_t kHeaderSize = 12; // as a CoW value behind its header
+  const int kRounds = 2048;
+  const int kRuns = 5;
+  char src[4096];
+  memset(src, 'a', sizeof(src));
+
+  size_t slots = (scratch_size - kHeaderSize) / 4096;
+  auto persist = [&](size_t size, bool nt) -> uint64_t {
+    uint64_t begin = __rdtsc();
+    for (int r = 0; r < kRounds; ++r) {
+      char *des = scratch + (r % slots) * 4096 + kHeaderSize;
+      if (nt) {
+        nt_store_range(des, src, size);
+        persistent_barrier();
+      } else {
+        memcpy(des, src, size);
+        clflushopt_range(des, size);
+      }
+    }
+    return __rdtsc() - begin;
+  };
+
+  // fault the scratch in and settle the clock before timing anything
+  persist(sizeof(src), false);
+  persist(sizeof(src), true);
+
+  size_t threshold = (size_t)-1;
+  for (int i = sizeof(kSizes) / sizeof(kSizes[0]) - 1; i >= 0; --i) {
+    size_t size = kSizes[i];
+    uint64_t cycles[2] = {(uint64_t)-1, (uint64_t)-1};
+    for (int run = 0; run < kRuns; ++run) {
+      for (int k = 0; k < 2; ++k) {
+        int nt = (run + k) % 2;
+        cycles[nt] = std::min(cycles[nt], persist(size, nt));
+      }
+    }
+
+    if (cycles[1] >= cycles[0]) {
+      break; // and not for smaller sizes either
+    }
+    threshold = size;
+  }
+
+  return threshold;
+}
+
 } // namespace persistent
 
 #endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#if !defined(_RECORD_RING_H_)
+#define _RECORD_RING_H_
+
+#include "nap_common.h"
+#include "slice.h"
+#include "timer.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace nap {
+
+// A sampled access, stored inline in a per-thread ring.  Keys longer than
+// ``kPayloadSize`` span several consecutive records sharing one timestamp;
+// the head record (part 0) is published last.
+struct alignas(kCachelineSize) PerRecord {
+  constexpr static uint32_t kPayloadSize = 51;
+  constexpr static uint32_t kMaxParts = 16;
+  constexpr static uint32_t kMaxKeySize = kPayloadSize * kMaxParts;
+
+  volatile uint64_t timestamp; // 0: not published yet
+  uint16_t key_size;
+  uint8_t part;
+  uint8_t part_cnt;
+  uint8_t is_write;
+  char payload[kPayloadSize];
+
+  PerRecord()
+      : timestamp(0), key_size(0), part(0), part_cnt(0), is_write(0) {}
+
+  static uint32_t parts_for(size_t key_size) {
+    return key_size == 0 ? 1 : (key_size + kPayloadSize - 1) / kPayloadSize;
+  }
+};
+
+// the write position of a producer thread in its own ring, counted in
+// records since start; published after the records themselves.
+struct alignas(kCachelineSize) RecordProducer {
+  std::atomic<uint64_t> seq;
+  // the samples behind ``seq``, and those skipped because the key is too
+  // long; only its producer writes
+  std::atomic<uint64_t> samples;
+  std::atomic<uint64_t> too_long;
+
+  RecordProducer() : seq(0), samples(0), too_long(0) {}
+};
+
+struct RecordCursor {
+  uint64_t last_ts;
+  uint64_t seq;
+
+  RecordCursor() : last_ts(0), seq(0) {}
+};
+
+static_assert(sizeof(PerRecord) == kCachelineSize, "XX");
+
+// Per-thread rings of sampled keys: worker threads ``record`` without
+// coordination, and a single consumer ``poll``s them into a detector.
+class RecordRing {
+private:
+  constexpr static uint32_t kRecordBufferSize = 8192; // 512KB per thread
+  // only threads in [thread_begin, thread_end) sample into this ring
+  int thread_begin, thread_end;
+  PerRecord *record_buffer[kMaxThreadCnt];
+  RecordProducer producers[kMaxThreadCnt];
+  RecordCursor cursors[kMaxThreadCnt];
+
+  // consumer-side feedback for adaptive sampling, written by the consumer
+  // and read by whoever queries it
+  std::atomic<uint64_t> dropped; // samples overwritten before being consumed
+  std::atomic<uint64_t> max_backlog; // largest backlog since the last query
+  uint64_t last_dropped;
+
+public:
+  RecordRing(int thread_begin = 0, int thread_end = kMaxThreadCnt)
+      : thread_begin(thread_begin), thread_end(thread_end), dropped(0),
+        max_backlog(0), last_dropped(0) {
+    for (int i = 0; i < kMaxThreadCnt; ++i) {
+      record_buffer[i] = nullptr;
+      if (i >= thread_begin && i < thread_end) {
+        record_buffer[i] = new PerRecord[kRecordBufferSize];
+      }
+    }
+  }
+
+  ~RecordRing() {
+    for (int i = 0; i < kMaxThreadCnt; ++i) {
+      if (record_buffer[i]) {
+        delete[] record_buffer[i];
+      }
+    }
+  }
+
+  void record(const Slice &key, bool is_write) {
+
+    // for threads that access keys.
+    int id = Topology::threadID();
+    auto *thread_records = record_buffer[id];
+    auto &producer = producers[id];
+    uint64_t index = producer.seq.load(std::memory_order_relaxed);
+
+    uint32_t part_cnt = PerRecord::parts_for(key.size());
+    if (part_cnt > PerRecord::kMaxParts) {
+      producer.too_long.store(
+          producer.too_long.load(std::memory_order_relaxed) + 1,
+          std::memory_order_relaxed);
+      return; // too long to be sampled
+    }
+
+    // record access pattern (key, timestamp), it is coordination-free
+    uint64_t ts = asm_rdtsc();
+    for (int p = part_cnt - 1; p >= 0; --p) {
+      auto &r = thread_records[(index + p) % kRecordBufferSize];
+      uint32_t off = p * PerRecord::kPayloadSize;
+      uint32_t len =
+          std::min<uint32_t>(key.size() - off, PerRecord::kPayloadSize);
+
+      r.timestamp = 0;
+      compiler_barrier();
+      r.key_size = key.size();
+      r.part = p;
+      r.part_cnt = part_cnt;
+      r.is_write = is_write;
+      memcpy(r.payload, key.data() + off, len);
+      compiler_barrier();
+      r.timestamp = ts;
+    }
+
+    producer.seq.store(index + part_cnt, std::memory_order_release);
+    producer.samples.store(
+        producer.samples.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+  }
+
+  // copy the sampled key at the cursor of thread ``i`` into ``buf``.
+  // return the number of records it occupies, or 0 if nothing is published;
+  // ``valid`` is false if the records were overwritten while being read.
+  uint32_t load_record(int i, char *buf, uint32_t &key_size, bool &is_write,
+                       bool &valid) {
+    auto &c = cursors[i];
+    auto *ring = record_buffer[i];
+    auto &head = ring[c.seq % kRecordBufferSize];
+
+    uint64_t ts = head.timestamp;
+    if (ts == 0 || ts < c.last_ts) {
+      return 0; // invalid record
+    }
+    compiler_barrier();
+
+    valid = false;
+    if (head.part != 0) { // overwritten by the producer, skip the fragment
+      return 1;
+    }
+
+    uint32_t part_cnt = head.part_cnt;
+    key_size = head.key_size;
+    is_write = head.is_write;
+    for (uint32_t p = 0; p < part_cnt; ++p) {
+      auto &r = ring[(c.seq + p) % kRecordBufferSize];
+      uint32_t off = p * PerRecord::kPayloadSize;
+      uint32_t len = std::min(key_size - off, PerRecord::kPayloadSize);
+      memcpy(buf + off, r.payload, len);
+      compiler_barrier();
+      if (r.timestamp != ts || r.part != p) {
+        return part_cnt; // torn by a concurrent producer
+      }
+    }
+
+    valid = true;
+    c.last_ts = ts;
+    return part_cnt;
+  }
+
+  // feed sampled keys to ``on_key(key, is_write, thread_id)`` for ``seconds``
+  template <class F> void poll(double seconds, F &&on_key) {
+
+    uint64_t ns = seconds * (1000ull * 1000 * 1000);
+    uint16_t kBatchPerThread = 8;
+    Timer timer;
+    timer.begin();
+
+    char key_buf[PerRecord::kMaxKeySize];
+    while (true) {
+      for (int i = thread_begin; i < thread_end; ++i) {
+        auto &c = cursors[i];
+        uint64_t produced = producers[i].seq.load(std::memory_order_acquire);
+        uint64_t backlog = produced - c.seq;
+        if (backlog > max_backlog.load(std::memory_order_relaxed)) {
+          max_backlog.store(backlog, std::memory_order_relaxed);
+        }
+        if (backlog > kRecordBufferSize) { // lapped, skip to recent records
+          uint64_t skip = backlog - kRecordBufferSize / 2;
+          // long keys take several records: count samples, at the
+          // producer's records per sample
+          uint64_t samples =
+              producers[i].samples.load(std::memory_order_relaxed);
+          dropped.fetch_add((double)skip * samples / produced,
+                            std::memory_order_relaxed);
+          c.seq += skip;
+        }
+
+        for (int k = 0; k < kBatchPerThread && c.seq < produced; ++k) {
+          uint32_t key_size;
+          bool is_write, valid;
+          uint32_t part_cnt =
+              load_record(i, key_buf, key_size, is_write, valid);
+          if (part_cnt == 0) {
+            break;
+          }
+
+          if (valid) {
+            on_key(Slice(key_buf, key_size), is_write, i);
+          }
+
+          c.seq += part_cnt;
+        }
+
+        if (timer.end() > ns) {
+          return;
+        }
+      }
+    }
+  }
+
+  // samples lost so far, by ring overwrite or oversized keys
+  uint64_t dropped_samples() {
+    uint64_t res = dropped.load(std::memory_order_relaxed);
+    for (int i = thread_begin; i < thread_end; ++i) {
+      res += producers[i].too_long.load(std::memory_order_relaxed);
+    }
+    return res;
+  }
+
+  // whether the consumer fell behind since the last query
+  bool is_saturated() {
+    uint64_t d = dropped.load(std::memory_order_relaxed);
+    uint64_t backlog = max_backlog.exchange(0, std::memory_order_relaxed);
+    bool res = d != last_dropped || backlog > kRecordBufferSize / 2;
+    last_dropped = d;
+    return res;
+  }
+};
+
+} // namespace nap
+
+#endif // _RECORD_RING_H_
@@ -47,114 +47,292 @@ struct ReadFirendlyLock {
   }
 };
 
-class WRLock {
-
+// A NUMA-aware reader-writer lock for read-mostly paths such as the
+// switch.  Each reader flags itself in its own cache line; the flags of a
+// node's threads form that node's reader indicator.  A reader backs off
+// while a writer is present, so a writer announces itself once and then
+// waits only for the readers that are already inside, instead of taking
+// every reader's slot in turn as ReadFirendlyLock does.
+class NumaRWLock {
 private:
-  std::atomic<uint16_t> l;
-  const static uint16_t UNLOCKED = 0x0;
-  const static uint16_t LOCKED = 0x1;
-  const static uint16_t PUT_LOCKED = 0x3;
+  struct alignas(kCachelineSize) ReaderFlag {
+    std::atomic<uint32_t> active;
+
+    ReaderFlag() : active(0) {}
+  };
+
+  // a node's row holds its workers' flags, then its committer's and its
+  // warmer's (Topology::committerID / warmerID)
+  constexpr static int kHelperCnt =
+      (kMaxThreadCnt - Topology::kReservedIDBegin) / Topology::kNumaCnt;
+
+  std::atomic<uint32_t> writer;
+  ReaderFlag readers[Topology::kNumaCnt][Topology::kCorePerNuma + kHelperCnt];
+
+  ReaderFlag &flag_of(int thread_id) {
+    int node = Topology::numaIDOf(thread_id);
+    if (thread_id >= Topology::kReservedIDBegin) {
+      int helper =
+          (thread_id - Topology::kReservedIDBegin) / Topology::kNumaCnt;
+      return readers[node][Topology::kCorePerNuma + helper];
+    }
+    return readers[node][thread_id - node * Topology::kCorePerNuma];
+  }
 
 public:
-  WRLock() { init(); }
+  static_assert(Topology::kReservedIDBegin ==
+                    Topology::kNumaCnt * Topology::kCorePerNuma,
+                "XX");
 
-  void operator=(const WRLock &o) { l.store(o.l.load()); }
+  NumaRWLock() : writer(0) {}
 
-  bool is_unlock() { return l.load() == UNLOCKED; }
+  bool write_lock() {
+    uint32_t f = 0;
+    while (!writer.compare_exchange_weak(f, 1)) {
+      f = 0;
+    }
 
-  void init() { l.store(UNLOCKED); }
+    for (auto &node : readers) {
+      for (auto &r : node) {
+        while (r.active.load()) {
+          ;
+        }
+      }
+    }
+    return true;
+  }
+
+  void write_unlock() { writer.store(0, std::memory_order_release); }
 
-  void wLock() {
+  // ``thread_id`` is unique among the lock's users, < kMaxThreadCnt
+  bool read_lock(int thread_id) {
+    auto &r = flag_of(thread_id);
     while (true) {
-      while (l.load(std::memory_order_relaxed) != UNLOCKED) {
-        ;
+      r.active.store(1); // sequentially consistent, as the check below
+      if (!writer.load()) {
+        return true;
       }
 
-      uint16_t f = UNLOCKED;
-      if (l.compare_exchange_strong(f, LOCKED)) {
-        break;
+      r.active.store(0, std::memory_order_release);
+      while (writer.load(std::memory_order_relaxed)) {
+        ;
       }
     }
+  }
+
+  void read_unlock(int thread_id) {
+    flag_of(thread_id).active.store(0, std::memory_order_release);
+  }
+
+  bool read_lock() { return read_lock(Topology::threadID()); }
+
+  void read_unlock() { read_unlock(Topology::threadID()); }
+};
+
+// The lock of a CNView entry.  Under a skewed workload a handful of hot
+// entries take the lock operations of every core, so
+//  - an uncontended acquisition is one atomic RMW: a reader adds itself and
+//    backs out if a writer is present, instead of looping on a CAS;
+//  - a contended one backs off exponentially between attempts and is
+//    counted in ``contended``, see CNView::contention;
+//  - the hottest entries may spread their readers over per-node counters
+//    (enable_node_readers), so that reads from different nodes do not
+//    share a line; a writer then also waits for every node's readers.
+class WRLock {
+
+private:
+  std::atomic<uint16_t> l; // writer state, plus READER per reader
+  const static uint16_t UNLOCKED = 0x0;
+  const static uint16_t LOCKED = 0x1;
+  const static uint16_t PUT_LOCKED = 0x3;
+  const static uint16_t WRITER_MASK = 0x3;
+  const static uint16_t READER = 0x4;
+  const static uint32_t kMaxBackoff = 256; // pause instructions
+
+  struct alignas(kCachelineSize) NodeReaders {
+    std::atomic<uint32_t> cnt;
+
+    NodeReaders() : cnt(0) {}
   };
 
-  bool try_wLock() {
-    if (l.load(std::memory_order_relaxed) != UNLOCKED)
-      return false;
+  std::atomic<uint32_t> contended; // acquisitions that had to wait or failed
+  NodeReaders *node_readers;       // per node, or nullptr
 
-    uint16_t f = UNLOCKED;
-    return l.compare_exchange_strong(f, LOCKED);
+  void count_contention() {
+    contended.fetch_add(1, std::memory_order_relaxed);
   }
 
-  void putLock() {
-    while (true) {
-      while (l.load(std::memory_order_relaxed) != UNLOCKED) {
-        ;
-      }
-
-      uint16_t f = UNLOCKED;
-      if (l.compare_exchange_strong(f, PUT_LOCKED)) {
-        break;
+  // called with the writer state set
+  void wait_node_readers() {
+    if (node_readers == nullptr) {
+      return;
+    }
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      while (node_readers[n].cnt.load() != 0) {
+        __builtin_ia32_pause();
       }
     }
-  };
+  }
 
-  bool try_putLock(bool &is_writer) {
-    uint16_t v;
-    if ((v = l.load(std::memory_order_relaxed)) != UNLOCKED) {
-      is_writer = v == PUT_LOCKED;
+  bool try_lock_as(uint16_t state) {
+    uint16_t f = UNLOCKED;
+    if (l.load(std::memory_order_relaxed) != UNLOCKED ||
+        !l.compare_exchange_strong(f, state)) {
       return false;
     }
+    wait_node_readers();
+    return true;
+  }
 
-    uint16_t f = UNLOCKED;
-    auto res = l.compare_exchange_strong(f, PUT_LOCKED);
-    is_writer = f == PUT_LOCKED;
+  void lock_as(uint16_t state) {
+    if (try_lock_as(state)) {
+      return;
+    }
 
-    return res;
+    count_contention();
+    uint32_t delay = 1;
+    do {
+      backoff(delay);
+    } while (!try_lock_as(state));
   }
 
-  void rLock() {
-    while (true) {
-      uint16_t v;
-      while (((v = l.load(std::memory_order_relaxed)) & 0x1) == LOCKED) {
-        ;
-      }
+  template <class C> bool try_read_as(std::atomic<C> &cnt, C inc) {
+    cnt.fetch_add(inc);
+    if ((l.load() & LOCKED) == 0) {
+      return true;
+    }
+    cnt.fetch_sub(inc, std::memory_order_relaxed);
+    return false;
+  }
+
+  template <class C> void read_as(std::atomic<C> &cnt, C inc) {
+    if (try_read_as(cnt, inc)) {
+      return;
+    }
 
-      uint16_t b = v + 4;
+    count_contention();
+    uint32_t delay = 1;
+    do {
+      do {
+        backoff(delay);
+      } while ((l.load(std::memory_order_relaxed) & LOCKED) != 0);
+    } while (!try_read_as(cnt, inc));
+  }
 
-      if (l.compare_exchange_strong(v, b)) {
-        break;
-      }
+  std::atomic<uint32_t> &my_node_readers() {
+    return node_readers[Topology::numaIDOf(Topology::threadID())].cnt;
+  }
+
+public:
+  WRLock() : contended(0), node_readers(nullptr) { init(); }
+
+  // between failed attempts, starting with ``delay`` = 1
+  static void backoff(uint32_t &delay) {
+    for (uint32_t i = 0; i < delay; ++i) {
+      __builtin_ia32_pause();
+    }
+    if (delay < kMaxBackoff) {
+      delay <<= 1;
     }
   }
 
-  bool try_rLock() {
-  retry:
-    uint16_t v = l.load(std::memory_order_relaxed);
-    if ((v & 0x1) == LOCKED)
-      return false;
+  void operator=(const WRLock &o) {
+    l.store(o.l.load());
+    contended.store(o.contended.load());
+  }
+
+  // no writer; readers may be inside
+  bool is_unlock() { return (l.load() & WRITER_MASK) == UNLOCKED; }
 
-    uint16_t b = v + 4;
-    if (!l.compare_exchange_strong(v, b)) {
-      goto retry; // concurrent reader;
+  void init() { l.store(UNLOCKED); }
+
+  // only while no other thread can reach the entry, e.g., before its view
+  // is published or after it is retired
+  void enable_node_readers() {
+    if (node_readers == nullptr) {
+      node_readers = new NodeReaders[Topology::kNumaCnt];
     }
+  }
 
-    return true;
+  void disable_node_readers() {
+    delete[] node_readers;
+    node_readers = nullptr;
   }
 
-  void rUnlock() {
-    while (true) {
-      uint16_t v = l.load();
-      uint16_t b = v - 4;
+  uint32_t contention() const {
+    return contended.load(std::memory_order_relaxed);
+  }
 
-      if (l.compare_exchange_strong(v, b)) {
-        break;
+  void wLock() { lock_as(LOCKED); }
+
+  bool try_wLock() { return try_lock_as(LOCKED); }
+
+  void putLock() { lock_as(PUT_LOCKED); }
+
+  bool try_putLock(bool &is_writer) {
+    uint16_t v = l.load(std::memory_order_relaxed);
+    if (v == UNLOCKED && l.compare_exchange_strong(v, PUT_LOCKED)) {
+      wait_node_readers();
+      is_writer = false;
+      return true;
+    }
+
+    count_contention();
+    is_writer = (v & WRITER_MASK) == PUT_LOCKED;
+    return false;
+  }
+
+  // acquire for a put; or return false, with ``is_writer`` set, as soon as
+  // another put holds the lock, which the caller may then join instead
+  bool putLock(bool &is_writer) {
+    if (try_putLock(is_writer) || is_writer) {
+      return !is_writer;
+    }
+
+    uint32_t delay = 1;
+    while (true) {
+      backoff(delay);
+      uint16_t v = l.load(std::memory_order_relaxed);
+      if ((v & WRITER_MASK) == PUT_LOCKED) {
+        is_writer = true;
+        return false;
+      }
+      if (v == UNLOCKED && l.compare_exchange_strong(v, PUT_LOCKED)) {
+        wait_node_readers();
+        return true;
       }
     }
   }
 
-  void wUnlock() { l.store(UNLOCKED, std::memory_order_release); }
+  void rLock() {
+    if (node_readers != nullptr) {
+      read_as(my_node_readers(), 1u);
+    } else {
+      read_as(l, READER);
+    }
+  }
+
+  bool try_rLock() {
+    bool res = node_readers != nullptr ? try_read_as(my_node_readers(), 1u)
+                                       : try_read_as(l, READER);
+    if (!res) {
+      count_contention();
+    }
+    return res;
+  }
+
+  void rUnlock() {
+    if (node_readers != nullptr) {
+      my_node_readers().fetch_sub(1, std::memory_order_release);
+    } else {
+      l.fetch_sub(READER, std::memory_order_release);
+    }
+  }
+
+  // clear the writer state only: optimistic readers may be counted in ``l``
+  void wUnlock() { l.fetch_and((uint16_t)~WRITER_MASK, std::memory_order_release); }
 
-  void putUnlock() { l.store(UNLOCKED, std::memory_order_release); }
+  void putUnlock() { l.fetch_and((uint16_t)~WRITER_MASK, std::memory_order_release); }
 };
 
 } // namespace nap
@@ -1,7 +1,6 @@
 #if !defined(_SP_VIEW_H_)
 #define _SP_VIEW_H_
 
-#include "murmur_hash2.h"
 #include "nap_common.h"
 #include "nvm.h"
 #include "slice.h"
@@ -9,85 +8,106 @@
 
 #include "cow_alloctor.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace nap {
 
-struct alignas(kCachelineSize) AlignedCounter {
-  std::atomic<uint64_t> ver;
-};
-
-inline uint64_t get_version(const Slice &s) {
-  static AlignedCounter ver[128];
-
-  int p = MurmurHash64A(s.data(), s.size()) % 128;
-
-  return ver[p].ver.fetch_add(1, std::memory_order::memory_order_relaxed);
-}
-
 class SPView {
   friend class NapMeta;
 
+private:
+  struct SPPair;
+
 public:
-  SPView() : size(0) { memset(&array, 0, sizeof(array)); }
+  class Arena;
 
-  SPView(const std::vector<std::pair<std::string, WhereIsData>> &list)
-      : size(list.size()) {
-    if (list.empty()) {
-      return;
-    }
+  SPView() : size(0), shared_cnt(0), arena(nullptr) {
+    memset(&array, 0, sizeof(array));
+    memset(&array_base, 0, sizeof(array_base));
+    std::fill(home_begin, home_begin + Topology::kNumaCnt + 1, 0);
+  }
 
-    size_t key_total_length = 0;
-    for (size_t i = 0; i < list.size(); ++i) {
-      key_total_length += list[i].first.size();
+  // slots [0, shared_cnt) are replicated on every node, where
+  // shared_cnt = |list| - sum(home_cnt); the next home_cnt[n] slots only
+  // exist on node n: keys written from that node, without reconciliation.
+  // With an ``arena``, the arrays and key blobs are taken from it.
+  SPView(const std::vector<std::pair<std::string, WhereIsData>> &list,
+         const std::vector<size_t> &home_cnt = {}, Arena *arena = nullptr)
+      : size(list.size()), shared_cnt(list.size()), arena(arena) {
+    memset(&array, 0, sizeof(array));
+    memset(&array_base, 0, sizeof(array_base));
+    for (auto cnt : home_cnt) {
+      shared_cnt -= cnt;
     }
-
-    pmem::obj::persistent_ptr<SPPair[]> array_p[Topology::kNumaCnt];
-    pmem::obj::persistent_ptr<char[]> keys_p[Topology::kNumaCnt];
-
-    for (int i = 0; i < Topology::kNumaCnt; ++i) {
-      pmem::obj::transaction::manual tx(*Topology::pmdk_pool_at(i));
-      array_p[i] = pmem::obj::make_persistent<SPPair[]>(list.size());
-      keys_p[i] = pmem::obj::make_persistent<char[]>(key_total_length);
-      pmem::obj::transaction::commit();
+    home_begin[0] = shared_cnt;
+    for (int n = 0; n < Topology::kNumaCnt; ++n) {
+      home_begin[n + 1] =
+          home_begin[n] + (n < (int)home_cnt.size() ? home_cnt[n] : 0);
     }
 
     for (int k = 0; k < Topology::kNumaCnt; ++k) {
-      array[k] = array_p[k].get();
-      auto keys_start = keys_p[k].get();
-      for (size_t i = 0; i < list.size(); ++i) {
-        auto k_len = list[i].first.size();
-        array_p[k][i].k_size = k_len;
-        array_p[k][i].k = keys_start;
+      size_t cnt = node_size(k);
+      if (cnt == 0) { // e.g., all hot keys are read-only
+        continue;
+      }
+
+      size_t key_total_length = 0;
+      for (size_t i = 0; i < cnt; ++i) {
+        key_total_length += list[list_index(k, i)].first.size();
+      }
+
+      size_t alloc_cnt = cnt + kSlotPerXPLine - 1; // room for the alignment
+      char *keys_start;
+      if (arena) {
+        arena->reserve(k, alloc_cnt, key_total_length);
+        array_base[k] = arena->array_base[k];
+        keys_start = arena->keys[k];
+      } else {
+        alloc(k, alloc_cnt, key_total_length, array_base[k], keys_start);
+      }
+
+      // start at an XPLine, so that adjacent slots share media lines
+      array[k] = (SPPair *)(((uintptr_t)array_base[k] + kXPLineSize - 1) &
+                            ~(uintptr_t)(kXPLineSize - 1));
+      auto *keys_begin = keys_start;
+      for (size_t i = 0; i < cnt; ++i) {
+        auto &key = list[list_index(k, i)].first;
+        auto k_len = key.size();
+        array[k][i].k_size = k_len;
+        array[k][i].k = keys_start;
+        array[k][i].ckpt_ver = 0;
 #ifdef FIX_8_BYTE_VALUE
-        array_p[k][i].type = 2;
+        array[k][i].type = 2;
 #else
-        array_p[k][i].v.v_ptr = nullptr;
+        array[k][i].v.v_ptr = nullptr;
 #endif
-        memcpy(keys_start, list[i].first.c_str(), k_len);
+        memcpy(keys_start, key.c_str(), k_len);
         keys_start += k_len;
       }
-      Topology::pmdk_pool()->persist(array_p[k]);
-      Topology::pmdk_pool()->persist(keys_p[k]);
+      persistent::clwb_range_nofence(array[k], cnt * sizeof(SPPair));
+      persistent::clwb_range_nofence(keys_begin, key_total_length);
     }
+    persistent::persistent_barrier();
   }
 
   ~SPView() {
     for (int i = 0; i < Topology::kNumaCnt; ++i) {
       if (array[i]) {
-        PMEMoid oid = pmemobj_oid(array[i]);
-        pmemobj_free(&oid);
-
 #ifndef FIX_8_BYTE_VALUE
-        for (size_t j = 0; j < size; ++j) {
+        for (size_t j = 0; j < node_size(i); ++j) {
           if (array[i][j].v.v_ptr) {
             cow_alloc.free(array[i][j].v.v_ptr);
           }
         }
 #endif
 
-        oid = pmemobj_oid(array[i][0].k);
-        pmemobj_free(&oid);
+        if (arena == nullptr) { // else they are left to the next view
+          PMEMoid oid = pmemobj_oid(array[i][0].k);
+          pmemobj_free(&oid);
+          oid = pmemobj_oid(array_base[i]);
+          pmemobj_free(&oid);
+        }
       }
     }
   }
@@ -137,124 +157,152 @@ public:
   void update(int index, char *ptr, const Slice &key, const Slice &value,
               uint64_t new_version, bool is_del = false) {
 
-#ifdef GLOBAL_VERSION
-    uint64_t v = get_version(key);
-#else
-    uint64_t v = new_version;
-#endif
-
-   if (is_del) {
-     new_version = (1ull << 63) || new_version;
-   }
-
-#ifdef FIX_8_BYTE_VALUE
-
-    // leverage in cache-line ordering, two-incarnation toggle mechanism
-    auto &e = array[Topology::numaID()][index];
-    uint8_t idx = e.type == 2 ? 0 : ((e.type + 1) % 2);
-
-    e.ver[idx] = v;
-    e.v64[idx] = *(uint64_t *)value.data();
-
-    compiler_barrier();
-    e.type = idx;
-
-    persistent::clwb(&e.type);
-    persistent::persistent_barrier();
-#else
-
-    auto buf_size = value.size() + sizeof(uint64_t) + sizeof(uint32_t);
-
-    *(uint64_t *)ptr = v;
-    *(uint32_t *)(ptr + sizeof(uint64_t)) = value.size();
-    memcpy(ptr + sizeof(uint64_t) + sizeof(uint32_t), value.data(),
-           value.size());
+    uint64_t v = new_version; // see CNView::Entry::next_version
 
-    persistent::clflushopt_range(ptr, buf_size);
-
-    auto &e = array[Topology::numaID()][index];
-    auto *free_array = get_thread_local_alloc_buf();
-    if (e.v.v_ptr) {
-
-      char *freed_ptr = e.v.v_ptr;
-      uint32_t free_size = *(uint32_t *)(e.v.v_ptr + sizeof(uint64_t)) +
-                           sizeof(uint64_t) + sizeof(uint32_t);
-      for (int i = 0; i < kAllocBufferSize; ++i) {
-        if (free_array[i].size < free_size) {
-          freed_ptr = free_array[i].buf;
-          free_array[i].size = free_size;
-          free_array[i].buf = e.v.v_ptr;
-          break;
-        }
-      }
-
-      if (freed_ptr) {
-        cow_alloc.free(freed_ptr);
-      }
+    if (ptr == nullptr) { // e.g., a deletion
+      ptr = alloc_before_update(key, value);
     }
-
-    e.v.v_ptr = ptr;
-    persistent::clwb_range(&e.v, sizeof(void *));
-
-#endif
-    // persistent::clflush(&e.v);
-    // Topology::pmdk_pool()->persist(&e.v, sizeof(void *));
+    write_slot(local_slot(index), ptr, value, v, is_del);
+    persistent::persistent_barrier();
 
     // CHECK
     // assert(e.k_size = key.size());
     // assert(memcmp(e.k, key.data(), key.size()) == 0);
   }
-  
 
-  // merge per-NUMA PM-resident PC-view into the raw index
-  template <class T> void flush_to_raw_index(T *raw_index) {
-    auto keys = array[0];
-    for (size_t i = 0; i < size; ++i) {
-
-      uint64_t v_max = 0;
+  // a new incarnation written by a group commit but not yet installed
+  struct Staged {
+    SPPair *e;
+    char *ptr; // nullptr if there is nothing left to install
+  };
 
+  // a group commit of slot ``index`` on behalf of the writers of ``node``,
+  // in two phases: the committer stages every entry of a round, fences once,
+  // installs them and fences once more.
+  Staged stage(int node, size_t index, const Slice &value, uint64_t ver,
+               bool is_del) {
+    int home = home_of(index);
+    auto &e = slot(home < 0 ? node : home, index);
 #ifdef FIX_8_BYTE_VALUE
-      uint64_t v = (uint64_t)(-1);
+    // an in-cacheline incarnation needs no ordering fence
+    write_slot(e, nullptr, value, ver, is_del);
+    return {&e, nullptr};
 #else
-      SPValue v;
+    char *ptr = alloc_before_update(Slice(), value);
+    write_value(ptr, value, ver, is_del);
+    return {&e, ptr};
+#endif
+  }
+
+  // called under the entry lock, once the staged values are persistent.  A
+  // home slot is committed by the committers of all nodes, so a round may
+  // install after a newer one did.
+  void install(const Staged &s) {
+    if (s.ptr == nullptr) {
+      return;
+    }
+#ifndef FIX_8_BYTE_VALUE
+    if (s.e->v.v_ptr && s.e->v.get_version() > *(uint64_t *)s.ptr) {
+      free_value(s.ptr, *(uint32_t *)(s.ptr + sizeof(uint64_t)) & ~kDeleted);
+      return;
+    }
+    install_value(*s.e, s.ptr);
 #endif
-      for (int k = 0; k < Topology::kNumaCnt; ++k) {
+  }
+
+  // find the newest incarnation of slot ``index`` across per-NUMA replicas;
+  // ``is_del`` if it is a tombstone
+  bool load_latest(size_t index, uint64_t &ver, std::string &value,
+                   bool &is_del) {
+    int latest = -1;
+    uint64_t v_max = 0;
+
+    int home = home_of(index);
+    int begin = home < 0 ? 0 : home;
+    int end = home < 0 ? Topology::kNumaCnt : home + 1;
+    for (int k = begin; k < end; ++k) {
 #ifdef FIX_8_BYTE_VALUE
-        auto idx = array[k][i].type;
-        if (idx == 2) {
-          continue;
-        }
-        auto cur_val = array[k][i].v64[idx];
-        auto cur_ver = array[k][i].ver[idx];
+      auto idx = slot(k, index).type;
+      if (idx == 2) {
+        continue;
+      }
+      auto cur_ver = slot(k, index).ver[idx] & ~kDeletedVer;
 #else
-        auto &cur_val = array[k][i].v;
-        if (cur_val.v_ptr == nullptr) {
-          continue;
-        }
-        auto cur_ver = cur_val.get_version();
+      auto &cur_val = slot(k, index).v;
+      if (cur_val.v_ptr == nullptr) {
+        continue;
+      }
+      auto cur_ver = cur_val.get_version();
 #endif
 
-        if (cur_ver > v_max) {
-          v_max = cur_ver;
-          v = cur_val;
-        }
+      if (latest == -1 || cur_ver > v_max) {
+        v_max = cur_ver;
+        latest = k;
       }
+    }
 
+    if (latest == -1) {
+      return false;
+    }
+
+    ver = v_max;
 #ifdef FIX_8_BYTE_VALUE
-      if (v != (uint64_t)(-1)) {
-        raw_index->put(Slice(keys[i].k, keys[i].k_size),
-                       Slice((char *)&v, sizeof(uint64_t)), true);
-      }
+    auto &e = slot(latest, index);
+    is_del = e.ver[e.type] & kDeletedVer;
+    value.assign((char *)&e.v64[e.type], sizeof(uint64_t));
 #else
-      if (v.v_ptr) {
-        raw_index->put(Slice(keys[i].k, keys[i].k_size),
-                       Slice(v.get_val(), v.get_size()), true);
-      }
+    auto &v = slot(latest, index).v;
+    is_del = v.is_deleted();
+    value.assign(v.get_val(), v.get_size());
 #endif
+    return true;
+  }
+
+  // a checkpoint has already written back version ``ver`` (or a newer one)
+  bool is_flushed(size_t index, uint64_t ver) {
+    return owner_slot(index).ckpt_ver > ver;
+  }
+
+  void mark_flushed(size_t index, uint64_t ver) {
+    auto &e = owner_slot(index);
+    e.ckpt_ver = ver + 1; // 0 means never flushed
+    persistent::clwb(&e.ckpt_ver);
+    persistent::persistent_barrier();
+  }
+
+  // merge per-NUMA PM-resident PC-view into the raw index
+  // slots [begin, end) only, if given
+  template <class T>
+  void flush_to_raw_index(T *raw_index, size_t begin = 0,
+                          size_t end = SIZE_MAX) {
+    std::string value;
+    for (size_t i = begin; i < std::min(end, (size_t)size); ++i) {
+      uint64_t ver;
+      bool is_del;
+      if (!load_latest(i, ver, value, is_del) || is_flushed(i, ver)) {
+        continue;
+      }
+
+      write_to(raw_index, i, value, is_del);
     }
   }
 
+  // write back a snapshot of slot ``index`` without changing the epoch
+  template <class T>
+  void write_back(T *raw_index, size_t index, uint64_t ver,
+                  const std::string &value, bool is_del) {
+    write_to(raw_index, index, value, is_del);
+    mark_flushed(index, ver);
+  }
+
+  size_t get_size() const { return size; }
+
 private:
+  // marks a tombstone: in the size of a CoW value, or in the version of an
+  // 8-byte incarnation
+  constexpr static uint32_t kDeleted = 1u << 31;
+  constexpr static uint64_t kDeletedVer = 1ull << 63;
+
   struct __attribute__((__packed__)) SPValue {
     char *v_ptr;
 
@@ -262,7 +310,13 @@ private:
 
     uint64_t get_version() { return *(uint64_t *)v_ptr; }
 
-    uint32_t get_size() { return *(uint32_t *)(v_ptr + sizeof(uint64_t)); }
+    uint32_t get_size() {
+      return *(uint32_t *)(v_ptr + sizeof(uint64_t)) & ~kDeleted;
+    }
+
+    bool is_deleted() {
+      return *(uint32_t *)(v_ptr + sizeof(uint64_t)) & kDeleted;
+    }
 
     char *get_val() { return v_ptr + sizeof(uint64_t) + sizeof(uint32_t); }
   };
@@ -271,7 +325,8 @@ private:
   struct __attribute__((__packed__)) SPPair {
     char *k;
     uint32_t k_size;
-    uint32_t padding[3];
+    uint32_t padding;
+    uint64_t ckpt_ver; // latest version written back by checkpoint, plus 1
     union {
       struct {
         SPValue v;
@@ -285,9 +340,208 @@ private:
   };
 
   static_assert(sizeof(SPPair) == 64, "XX");
+  constexpr static size_t kSlotPerXPLine = kXPLineSize / sizeof(SPPair);
 
-  SPPair *array[Topology::kNumaCnt];
+  SPPair *array[Topology::kNumaCnt];      // XPLine aligned
+  SPPair *array_base[Topology::kNumaCnt]; // as allocated
   size_t size;
+  size_t shared_cnt;
+  // home slots of node n are [home_begin[n], home_begin[n + 1])
+  size_t home_begin[Topology::kNumaCnt + 1];
+  Arena *arena; // owns the arrays and key blobs, or nullptr
+
+  // ``cnt`` slots and ``key_len`` bytes of keys on ``node``, in one
+  // transaction
+  static void alloc(int node, size_t cnt, size_t key_len, SPPair *&array,
+                    char *&keys) {
+    pmem::obj::persistent_ptr<SPPair[]> array_p;
+    pmem::obj::persistent_ptr<char[]> keys_p;
+    {
+      pmem::obj::transaction::manual tx(*Topology::pmdk_pool_at(node));
+      array_p = pmem::obj::make_persistent<SPPair[]>(cnt);
+      keys_p = pmem::obj::make_persistent<char[]>(std::max(key_len, 1ul));
+      pmem::obj::transaction::commit();
+    }
+    array = array_p.get();
+    keys = keys_p.get();
+  }
+
+  template <class T>
+  void write_to(T *raw_index, size_t index, const std::string &value,
+                bool is_del) {
+    auto &key = owner_slot(index);
+    if (is_del) {
+      raw_index->del(Slice(key.k, key.k_size));
+    } else {
+      raw_index->put(Slice(key.k, key.k_size), Slice(value), true);
+    }
+  }
+
+  // write a new incarnation of ``e``, a tombstone if ``is_del``, leaving the
+  // final fence to the caller
+  void write_slot(SPPair &e, char *ptr, const Slice &value, uint64_t v,
+                  bool is_del) {
+#ifdef FIX_8_BYTE_VALUE
+
+    // leverage in cache-line ordering, two-incarnation toggle mechanism
+    uint8_t idx = e.type == 2 ? 0 : ((e.type + 1) % 2);
+
+    e.ver[idx] = is_del ? v | kDeletedVer : v;
+    e.v64[idx] = is_del ? 0 : *(uint64_t *)value.data();
+
+    compiler_barrier();
+    e.type = idx;
+
+    persistent::clwb(&e.type);
+#else
+
+    write_value(ptr, value, v, is_del);
+    persistent::persistent_barrier(); // the value before the ptr
+    install_value(e, ptr);
+
+#endif
+  }
+
+#ifndef FIX_8_BYTE_VALUE
+  // write an incarnation out of place, without fences
+  void write_value(char *ptr, const Slice &value, uint64_t v, bool is_del) {
+    *(uint64_t *)ptr = v;
+    *(uint32_t *)(ptr + sizeof(uint64_t)) =
+        value.size() | (is_del ? kDeleted : 0);
+    if (value.size() >= nt_store_threshold) {
+      persistent::nt_store_range(ptr + sizeof(uint64_t) + sizeof(uint32_t),
+                                 value.data(), value.size());
+      persistent::clwb_range_nofence(ptr, sizeof(uint64_t) + sizeof(uint32_t));
+    } else {
+      memcpy(ptr + sizeof(uint64_t) + sizeof(uint32_t), value.data(),
+             value.size());
+      persistent::clwb_range_nofence(ptr, value.size() + sizeof(uint64_t) +
+                                              sizeof(uint32_t));
+    }
+  }
+
+  // point ``e`` to a persistent incarnation, without fences
+  void install_value(SPPair &e, char *ptr) {
+    if (e.v.v_ptr) {
+      free_value(e.v.v_ptr, e.v.get_size());
+    }
+
+    e.v.v_ptr = ptr;
+    persistent::clwb_range_nofence(&e.v, sizeof(void *));
+  }
+
+  void free_value(char *ptr, uint32_t size) {
+    auto *free_array = get_thread_local_alloc_buf();
+    char *freed_ptr = ptr;
+    uint32_t free_size = size + sizeof(uint64_t) + sizeof(uint32_t);
+    for (int i = 0; i < kAllocBufferSize; ++i) {
+      if (free_array[i].size < free_size) {
+        freed_ptr = free_array[i].buf;
+        free_array[i].size = free_size;
+        free_array[i].buf = ptr;
+        break;
+      }
+    }
+
+    if (freed_ptr) {
+      cow_alloc.free(freed_ptr);
+    }
+  }
+#endif
+
+  size_t node_size(int node) const {
+    return shared_cnt + home_begin[node + 1] - home_begin[node];
+  }
+
+  // the position in ``list`` of the i-th slot of ``node``
+  size_t list_index(int node, size_t i) const {
+    return i < shared_cnt ? i : home_begin[node] + i - shared_cnt;
+  }
+
+  // the node owning a home slot, or -1 for a replicated slot
+  int home_of(size_t index) const {
+    if (index < shared_cnt) {
+      return -1;
+    }
+    int n = 0;
+    while (index >= home_begin[n + 1]) {
+      n++;
+    }
+    return n;
+  }
+
+  SPPair &slot(int node, size_t index) {
+    if (index < shared_cnt) {
+      return array[node][index];
+    }
+    return array[node][shared_cnt + index - home_begin[node]];
+  }
+
+  // where the current thread writes: its own node, or the home node
+  SPPair &local_slot(size_t index) {
+    int home = home_of(index);
+    return slot(home < 0 ? Topology::numaID() : home, index);
+  }
+
+  // holds the key and the checkpoint version of a slot
+  SPPair &owner_slot(size_t index) {
+    int home = home_of(index);
+    return slot(home < 0 ? 0 : home, index);
+  }
+
+public:
+  // The PC-View arrays and key blobs of each node, kept across epochs.  A
+  // view built on an arena overwrites what the arena's previous view left,
+  // which must be deleted, and only allocates when it needs more room.
+  class Arena {
+    friend class SPView;
+
+  public:
+    Arena() {
+      for (int n = 0; n < Topology::kNumaCnt; ++n) {
+        array_base[n] = nullptr;
+        keys[n] = nullptr;
+        array_cap[n] = keys_cap[n] = 0;
+      }
+    }
+
+    ~Arena() {
+      for (int n = 0; n < Topology::kNumaCnt; ++n) {
+        release(n);
+      }
+    }
+
+  private:
+    SPPair *array_base[Topology::kNumaCnt];
+    char *keys[Topology::kNumaCnt];
+    size_t array_cap[Topology::kNumaCnt];
+    size_t keys_cap[Topology::kNumaCnt];
+
+    void reserve(int node, size_t cnt, size_t key_len) {
+      if (cnt <= array_cap[node] && key_len <= keys_cap[node]) {
+        return;
+      }
+
+      release(node);
+      cnt = std::max(cnt, array_cap[node]);
+      key_len = std::max(key_len, keys_cap[node]);
+      alloc(node, cnt, key_len, array_base[node], keys[node]);
+      array_cap[node] = cnt;
+      keys_cap[node] = key_len;
+    }
+
+    void release(int node) {
+      if (array_base[node] == nullptr) {
+        return;
+      }
+      PMEMoid oid = pmemobj_oid(array_base[node]);
+      pmemobj_free(&oid);
+      oid = pmemobj_oid(keys[node]);
+      pmemobj_free(&oid);
+      array_base[node] = nullptr;
+      keys[node] = nullptr;
+    }
+  };
 };
 
 } // namespace nap
@@ -0,0 +1,297 @@
+#if !defined(_STREAM_SUMMARY_H_)
+#define _STREAM_SUMMARY_H_
+
+#include "murmur_hash2.h"
+#include "slice.h"
+#include "top_k.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace nap {
+
+// Space-Saving top-k over a stream-summary: counters with the same count
+// hang off one bucket, and buckets form a list sorted by count, so each
+// access is O(1).  Keys live in a fixed-size arena (longer keys overflow to
+// a string); key => counter is an open-addressing table without allocation.
+// It monitors ``kCounterPerKey`` x K keys, so the reported top-K is not
+// polluted by recently admitted keys of the long tail.
+class StreamSummary {
+private:
+  constexpr static int kCounterPerKey = 4;
+  constexpr static uint32_t kKeySlot = 32;
+  constexpr static int32_t kNull = -1;
+
+  struct Bucket {
+    uint32_t cnt;
+    int32_t prev, next; // sorted by cnt, ascending
+    int32_t head;       // first counter in this bucket
+  };
+
+  struct Counter {
+    uint64_t hash;
+    int32_t bucket;
+    int32_t prev, next; // counters in the same bucket
+    uint32_t key_size;
+  };
+
+  int K;
+  int capacity;
+  int size;
+
+  std::vector<Counter> counters;
+  std::vector<Bucket> buckets;
+  int32_t free_bucket;
+  int32_t min_bucket;
+  int32_t max_bucket;
+
+  std::vector<char> key_arena;
+  std::vector<std::string> long_keys;
+
+  std::vector<int32_t> slots; // hash table of counter ids
+  uint64_t mask;
+
+  std::vector<Node> list;
+
+public:
+  StreamSummary(int k)
+      : K(k), capacity(k * kCounterPerKey), counters(capacity),
+        buckets(capacity + 1), key_arena((size_t)capacity * kKeySlot),
+        long_keys(capacity) {
+    uint64_t cap = 1;
+    while (cap < 2ull * capacity) {
+      cap <<= 1;
+    }
+    slots.resize(cap);
+    mask = cap - 1;
+
+    reset();
+  }
+
+  void reset() {
+    size = 0;
+    min_bucket = max_bucket = kNull;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      buckets[i].next = i + 1 < buckets.size() ? i + 1 : kNull;
+    }
+    free_bucket = 0;
+    std::fill(slots.begin(), slots.end(), kNull);
+  }
+
+  // halve all counts; buckets that become equal are merged
+  void decay() {
+    for (int32_t b = min_bucket; b != kNull;) {
+      int32_t next = buckets[b].next;
+      buckets[b].cnt >>= 1;
+
+      int32_t prev = buckets[b].prev;
+      if (prev != kNull && buckets[prev].cnt == buckets[b].cnt) {
+        while (buckets[b].head != kNull) {
+          int32_t c = buckets[b].head;
+          detach_from_bucket(c);
+          attach_to_bucket(c, prev);
+        }
+        free_bucket_if_empty(b);
+      }
+      b = next;
+    }
+  }
+
+  void access_a_key(const Slice &key) {
+    uint64_t h = MurmurHash64A(key.data(), key.size());
+
+    int32_t c = lookup(key, h);
+    if (c != kNull) {
+      increment(c);
+      return;
+    }
+
+    if (size < capacity) { // a new counter with count 1
+      c = size++;
+      set_key(c, key, h);
+      attach_to_bucket(c, bucket_of_count_one());
+      return;
+    }
+
+    // replace the key with minimal count, inheriting the count as error
+    c = buckets[min_bucket].head;
+    erase_slot(counters[c].hash, c);
+    set_key(c, key, h);
+    increment(c);
+  }
+
+  // the K hottest keys, compatible with TopK::get_list: slot 0 is a fence
+  std::vector<Node> &get_list() {
+    list.clear();
+    list.push_back({"FENCE_KEY", 0});
+    for (int32_t b = max_bucket; b != kNull; b = buckets[b].prev) {
+      for (int32_t c = buckets[b].head; c != kNull; c = counters[c].next) {
+        if ((int)list.size() > K) {
+          return list;
+        }
+        list.push_back(Node(std::string(key_ptr(c), counters[c].key_size),
+                            buckets[b].cnt));
+      }
+    }
+    return list;
+  }
+
+private:
+  const char *key_ptr(int32_t c) const {
+    if (counters[c].key_size > kKeySlot) {
+      return long_keys[c].data();
+    }
+    return key_arena.data() + (size_t)c * kKeySlot;
+  }
+
+  void set_key(int32_t c, const Slice &key, uint64_t h) {
+    auto &e = counters[c];
+    e.hash = h;
+    e.key_size = key.size();
+    if (key.size() > kKeySlot) {
+      long_keys[c].assign(key.data(), key.size());
+    } else {
+      memcpy(key_arena.data() + (size_t)c * kKeySlot, key.data(), key.size());
+    }
+
+    uint64_t pos = h & mask;
+    while (slots[pos] != kNull) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = c;
+  }
+
+  int32_t lookup(const Slice &key, uint64_t h) const {
+    uint64_t pos = h & mask;
+    for (; slots[pos] != kNull; pos = (pos + 1) & mask) {
+      auto c = slots[pos];
+      if (counters[c].hash == h && counters[c].key_size == key.size() &&
+          memcmp(key_ptr(c), key.data(), key.size()) == 0) {
+        return c;
+      }
+    }
+    return kNull;
+  }
+
+  // linear probing deletion with backward shift
+  void erase_slot(uint64_t h, int32_t c) {
+    uint64_t i = h & mask;
+    while (slots[i] != c) {
+      i = (i + 1) & mask;
+    }
+
+    slots[i] = kNull;
+    for (uint64_t j = (i + 1) & mask; slots[j] != kNull; j = (j + 1) & mask) {
+      uint64_t home = counters[slots[j]].hash & mask;
+      bool in_place =
+          i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (in_place) {
+        continue;
+      }
+      slots[i] = slots[j];
+      slots[j] = kNull;
+      i = j;
+    }
+  }
+
+  int32_t alloc_bucket(uint32_t cnt, int32_t prev, int32_t next) {
+    int32_t b = free_bucket;
+    assert(b != kNull);
+    free_bucket = buckets[b].next;
+
+    buckets[b].cnt = cnt;
+    buckets[b].prev = prev;
+    buckets[b].next = next;
+    buckets[b].head = kNull;
+    if (prev != kNull) {
+      buckets[prev].next = b;
+    } else {
+      min_bucket = b;
+    }
+    if (next != kNull) {
+      buckets[next].prev = b;
+    } else {
+      max_bucket = b;
+    }
+    return b;
+  }
+
+  void free_bucket_if_empty(int32_t b) {
+    auto &e = buckets[b];
+    if (e.head != kNull) {
+      return;
+    }
+
+    if (e.prev != kNull) {
+      buckets[e.prev].next = e.next;
+    } else {
+      min_bucket = e.next;
+    }
+    if (e.next != kNull) {
+      buckets[e.next].prev = e.prev;
+    } else {
+      max_bucket = e.prev;
+    }
+
+    e.next = free_bucket;
+    free_bucket = b;
+  }
+
+  int32_t bucket_of_count_one() {
+    int32_t prev = kNull, b = min_bucket;
+    while (b != kNull && buckets[b].cnt < 1) { // decayed to zero
+      prev = b;
+      b = buckets[b].next;
+    }
+
+    if (b != kNull && buckets[b].cnt == 1) {
+      return b;
+    }
+    return alloc_bucket(1, prev, b);
+  }
+
+  void attach_to_bucket(int32_t c, int32_t b) {
+    auto &e = counters[c];
+    e.bucket = b;
+    e.prev = kNull;
+    e.next = buckets[b].head;
+    if (e.next != kNull) {
+      counters[e.next].prev = c;
+    }
+    buckets[b].head = c;
+  }
+
+  void detach_from_bucket(int32_t c) {
+    auto &e = counters[c];
+    if (e.prev != kNull) {
+      counters[e.prev].next = e.next;
+    } else {
+      buckets[e.bucket].head = e.next;
+    }
+    if (e.next != kNull) {
+      counters[e.next].prev = e.prev;
+    }
+  }
+
+  void increment(int32_t c) {
+    int32_t b = counters[c].bucket;
+    uint32_t cnt = buckets[b].cnt + 1;
+    int32_t next = buckets[b].next;
+
+    int32_t target = next;
+    if (next == kNull || buckets[next].cnt != cnt) {
+      target = alloc_bucket(cnt, b, next);
+    }
+
+    detach_from_bucket(c);
+    attach_to_bucket(c, target);
+    free_bucket_if_empty(b);
+  }
+};
+
+} // namespace nap
+
+#endif // _STREAM_SUMMARY_H_
@@ -0,0 +1,66 @@
+#if !defined(_TINY_LFU_H_)
+#define _TINY_LFU_H_
+
+#include "count_min_sketch.h"
+#include "murmur_hash3.h"
+#include "slice.h"
+
+#include <cstring>
+#include <vector>
+
+namespace nap {
+
+// TinyLFU-style admission: a doorkeeper bloom filter absorbs the first
+// access of every key, so the long tail of one-off keys never reaches the
+// sketch or competes for the min heap.  Aging clears the doorkeeper and
+// halves the sketch, as in the TinyLFU reset.
+class TinyLFU {
+private:
+  constexpr static uint64_t kDoorkeeperBits = 1ull << 23; // 1MB
+  constexpr static int kDoorkeeperHashCnt = 2;
+  constexpr static uint32_t kDoorkeeperSeed = 1974701;
+
+  std::vector<uint64_t> doorkeeper;
+  CountMin cm;
+
+  // set the bits of ``key``; return whether all of them were set already
+  bool doorkeeper_test_and_set(const Slice &key) {
+    uint64_t h[2];
+    MurmurHash3_x64_128(key.data(), key.size(), h, kDoorkeeperSeed);
+
+    bool seen = true;
+    for (int i = 0; i < kDoorkeeperHashCnt; ++i) {
+      uint64_t bit = (h[0] + i * h[1]) & (kDoorkeeperBits - 1);
+      uint64_t mask = 1ull << (bit % 64);
+      seen &= (doorkeeper[bit / 64] & mask) != 0;
+      doorkeeper[bit / 64] |= mask;
+    }
+    return seen;
+  }
+
+public:
+  TinyLFU(int hot_keys_cnt)
+      : doorkeeper(kDoorkeeperBits / 64, 0), cm(hot_keys_cnt) {}
+
+  std::vector<Node> &get_list() { return cm.get_list(); }
+
+  void decay() {
+    std::fill(doorkeeper.begin(), doorkeeper.end(), 0);
+    cm.decay();
+  }
+
+  void reset() {
+    std::fill(doorkeeper.begin(), doorkeeper.end(), 0);
+    cm.reset();
+  }
+
+  void access_a_key(const Slice &key) {
+    if (doorkeeper_test_and_set(key)) {
+      cm.access_a_key(key);
+    }
+  }
+};
+
+} // namespace nap
+
+#endif // _TINY_LFU_H_
@@ -1,6 +1,7 @@
 #if !defined(_NAP_HEAP_H_)
 #define _NAP_HEAP_H_
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 #include <unordered_map>
@@ -12,7 +13,11 @@ namespace nap
 struct Node {
 	std::string key;
 	int cnt;
-	Node(const std::string &s, int c) : key(s), cnt(c)
+	int write_cnt; // the part of ``cnt`` sampled from writes
+	int home_node; // the node most samples come from, -1 if unknown
+	int home_cnt;  // the part of ``cnt`` sampled on ``home_node``
+	Node(const std::string &s, int c, int w = 0)
+	    : key(s), cnt(c), write_cnt(w), home_node(-1), home_cnt(0)
 	{
 	}
 	bool
@@ -22,11 +27,42 @@ struct Node {
 	}
 };
 
+// hotter first; saturated counters tie, so ties are ordered by key
+inline bool
+hotter(const Node &a, const Node &b)
+{
+	return a.cnt > b.cnt || (a.cnt == b.cnt && a.key < b.key);
+}
+
+// put the hottest ``k`` nodes of ``l``, whose slot 0 is the fence, first and
+// in order, and the coldest one last; the others are left unordered.  Linear
+// in the size of ``l`` plus k log k, instead of a full sort.
+inline void
+select_hottest(std::vector<Node> &l, size_t k)
+{
+	if (l.size() <= 2) {
+		return;
+	}
+
+	auto first = l.begin() + 1;
+	auto mid = first + std::min(k, l.size() - 1);
+	std::nth_element(first, mid, l.end(), hotter);
+	std::sort(first, mid, hotter);
+
+	if (mid != l.end()) {
+		std::iter_swap(std::max_element(mid, l.end(), hotter),
+			       l.end() - 1);
+	}
+}
+
 inline void
 swapNode(Node &a, Node &b)
 {
 	// std::swap(a, b);
 	std::swap(a.cnt, b.cnt);
+	std::swap(a.write_cnt, b.write_cnt);
+	std::swap(a.home_node, b.home_node);
+	std::swap(a.home_cnt, b.home_cnt);
 	a.key.swap(b.key);
 }
 
@@ -53,6 +89,15 @@ public:
 		size = 1;
 	}
 
+	// halving keeps the heap order, so no sifting is needed
+	void
+	decay()
+	{
+		for (size_t i = 1; i < minHeap.size(); ++i) {
+			minHeap[i].cnt >>= 1;
+		}
+	}
+
 	std::vector<Node> &
 	get_list()
 	{
@@ -47,21 +47,76 @@ class Topology {
 
   static std::atomic<int> counter;
 
+  static int &local_id() {
+    thread_local static int my_id = -1;
+    return my_id;
+  }
+
 public:
   constexpr static int kNumaCnt = 4;
   constexpr static int kCorePerNuma = 18;
-  static int threadID() {
 
-    thread_local static int my_id = counter.fetch_add(1);
+  // the last ids are never handed out: they belong to the helper threads of
+  // each node, so that their per-thread state (allocator slabs, logs, lock
+  // slots) is not shared with a worker's
+  constexpr static int kReservedIDBegin = kMaxThreadCnt - 2 * kNumaCnt;
+  static int committerID(int node) { return kReservedIDBegin + node; }
+  static int warmerID(int node) { return kReservedIDBegin + kNumaCnt + node; }
+
+  // helper threads pinned to a core of the node they serve
+  enum HelperRole { HELPER_COMMITTER, HELPER_AGGREGATOR, HELPER_ROLE_CNT };
+
+  // by default the second to last and the last core of each node.  Workers
+  // bound by thread id reach those cores once a node holds more than
+  // kCorePerNuma - 2 of them; move the helpers elsewhere (a spare core or a
+  // hyper-thread sibling), or pass -1 to let one run on any core of its
+  // node.  Takes effect for helpers started afterwards, i.e. call it before
+  // constructing Nap.
+  static void setHelperCore(HelperRole role, int node, int core) {
+    helper_core[role][node] = core;
+  }
+  static int helperCore(HelperRole role, int node) {
+    return helper_core[role][node];
+  }
+
+private:
+  static int helper_core[HELPER_ROLE_CNT][kNumaCnt];
+
+public:
+
+  // ids are handed out in order from 1 on, see reset(); at most
+  // kReservedIDBegin - 1 workers, so that none takes a helper's id
+  static int threadID() {
+    int &my_id = local_id();
+    if (my_id < 0) {
+      my_id = counter.fetch_add(1);
+      if (my_id >= kReservedIDBegin) {
+        printf("thread id %d is reserved, at most %d workers!\n", my_id,
+               kReservedIDBegin - 1);
+        exit(-1);
+      }
+    }
     return my_id;
   }
 
+  // before the thread calls threadID()
+  static void setThreadID(int id) { local_id() = id; }
+
   static void reset() {
     counter.store(1);
     // id 0 is shift thread
   }
 
-  static int numaID() { return threadID() / kCorePerNuma; }
+  static int numaID() { return numaIDOf(threadID()); }
+
+  // the node of thread ``thread_id``; a reserved id belongs to the node its
+  // helper serves
+  static int numaIDOf(int thread_id) {
+    if (thread_id >= kReservedIDBegin) {
+      return (thread_id - kReservedIDBegin) % kNumaCnt;
+    }
+    return thread_id / kCorePerNuma;
+  }
 
   static pmem::obj::pool_base *pmdk_pool() { return nap_pop_numa + numaID(); }
 
@@ -69,6 +124,26 @@ public:
     return nap_pop_numa + numa_id;
   }
 };
+
+// run on any core of ``node``; false if it has none here
+inline bool bindNode(int node) {
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int c = 0; c < Topology::kCorePerNuma; ++c) {
+    CPU_SET(node * Topology::kCorePerNuma + c, &cpuset);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                &cpuset) == 0;
+}
+
+inline void bindHelper(Topology::HelperRole role, int node) {
+  int core = Topology::helperCore(role, node);
+  if (core < 0) {
+    bindNode(node);
+  } else {
+    bindCore(core);
+  }
+}
 } // namespace nap
 
 #endif // _TOPOLOGY_H_
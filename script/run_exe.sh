@@ -9,6 +9,7 @@ cd ../build
 rm CMakeCache.txt
 cmake -DENABLE_NAP_FLAG=OFF .. && make -j
 
+# at most 71 workers: the last thread ids belong to Nap's helper threads
 threads=(2 6 12 18 24 30 36 42 48 54 60 66 71)
 
 exe=./$1_nap
@@ -60,6 +60,11 @@ void init_numa_pool()
   {
     numa_map[i] = 3;
   }
+  // helper threads of Nap, e.g., warmers
+  for (int i = nap::Topology::kReservedIDBegin; i < nap::kMaxThreadCnt; ++i)
+  {
+    numa_map[i] = nap::Topology::numaIDOf(i);
+  }
 
   for (int i = 0; i < nap::Topology::kNumaCnt; ++i)
   {
@@ -1,6 +1,7 @@
 #include "index/masstree.h"
 #include "index/Epoche.cpp"
 #include "index/NUMA_Config.h"
+#include "nvm.h"
 
 // std::atomic<uint64_t> update_counter{0};
 
@@ -16,6 +17,12 @@ static inline void mfence() { asm volatile("mfence" ::: "memory"); }
 
 // #define CLWB
 static inline void clflush(char *data, int len, bool fence) {
+  if (!persistent::flush_needed()) { // see persistent::persist_policy
+    if (fence)
+      persistent::persistent_barrier();
+    return;
+  }
+
   volatile char *ptr = (char *)((unsigned long)data & ~(CACHE_LINE_SIZE - 1));
   if (fence)
     mfence();
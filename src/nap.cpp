@@ -6,6 +6,7 @@ pmem::obj::pool_base nap_pop_numa[kMaxNumaCnt];
 ThreadMeta thread_meta_array[kMaxThreadCnt];
 
 CowAlloctor *cow_alloc;
+size_t nt_store_threshold = -1;
 
 
 } // namespace nap
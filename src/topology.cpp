@@ -2,4 +2,11 @@
 
 namespace nap {
 std::atomic<int> Topology::counter{0};
+
+static_assert(Topology::kNumaCnt == 4, "one helper core per node below");
+#define LAST_CORE(node, nth) ((node + 1) * Topology::kCorePerNuma - 1 - nth)
+int Topology::helper_core[HELPER_ROLE_CNT][kNumaCnt] = {
+    {LAST_CORE(0, 1), LAST_CORE(1, 1), LAST_CORE(2, 1), LAST_CORE(3, 1)},
+    {LAST_CORE(0, 0), LAST_CORE(1, 0), LAST_CORE(2, 0), LAST_CORE(3, 0)}};
+#undef LAST_CORE
 } // namespace nap
@@ -0,0 +1,144 @@
+#include "count_min_sketch.h"
+#include "hotkey_trace.h"
+#include "timer.h"
+
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+// Accuracy and throughput of CountMin against the original sketch
+// (3 MurmurHash64A passes, 32-bit counters, unconditional increments).
+// Ground truth is the output of ``generate_top_k``.
+
+constexpr uint64_t MB = 1024ull * 1024;
+constexpr int kKeyLen = 16;
+
+// the original implementation
+class BaselineCountMin {
+  const static int kHashCnt = 3;
+  const static int kBloomLength = 876199;
+  uint32_t *bloom_array[kHashCnt];
+  uint64_t hash_seed[kHashCnt] = {931901, 1974701, 7296907};
+
+  nap::TopK topK;
+
+public:
+  BaselineCountMin(int hot_keys_cnt) : topK(hot_keys_cnt) {
+    for (int i = 0; i < kHashCnt; ++i) {
+      bloom_array[i] = new uint32_t[kBloomLength];
+      memset(bloom_array[i], 0, kBloomLength * sizeof(uint32_t));
+    }
+  }
+
+  std::vector<nap::Node> &get_list() { return topK.get_list(); }
+
+  void access_a_key(const nap::Slice &key) {
+    uint64_t hash_val[kHashCnt];
+    for (int i = 0; i < kHashCnt; ++i) {
+      hash_val[i] =
+          (MurmurHash64A(key.data(), key.size(), hash_seed[i])) % kBloomLength;
+    }
+
+    uint64_t min_freq = ++bloom_array[0][hash_val[0]];
+    for (int i = 1; i < kHashCnt; ++i) {
+      auto tmp = ++bloom_array[i][hash_val[i]];
+      if (tmp < min_freq) {
+        min_freq = tmp;
+      }
+    }
+    topK.access_a_key(key.ToString(), min_freq);
+  }
+};
+
+std::vector<std::string> trace;
+std::unordered_map<std::string, uint64_t> exact; // only ground-truth keys
+
+// the same key format as ``generate_top_k``
+std::string make_key(uint64_t key) {
+  uint64_t buf[kKeyLen / sizeof(uint64_t) + 1];
+  for (size_t j = 0; j < kKeyLen / sizeof(uint64_t) + 1; ++j) {
+    buf[j] = key;
+  }
+  char *char_buf = (char *)buf;
+  for (int j = 0; j < kKeyLen; ++j) {
+    if (char_buf[j] == '\n') {
+      char_buf[j] = '4';
+    }
+  }
+  return std::string(char_buf, kKeyLen);
+}
+
+void load_ground_truth(const char *file_name) {
+  std::ifstream file(file_name);
+  if (!file) {
+    printf("can not open %s\n", file_name);
+    exit(-1);
+  }
+
+  char buf[kKeyLen + 1];
+  while (file.read(buf, kKeyLen + 1)) {
+    exact[std::string(buf, kKeyLen)] = 0;
+  }
+}
+
+template <class CM> void run(const char *name, int hot_cnt, uint64_t sat) {
+  CM cm(hot_cnt);
+
+  nap::Timer timer;
+  timer.begin();
+  for (auto &k : trace) {
+    cm.access_a_key(nap::Slice(k));
+  }
+  auto ns = timer.end();
+
+  auto &l = cm.get_list();
+  uint64_t hit = 0;
+  double err = 0;
+  for (size_t i = 1; i < l.size(); ++i) {
+    auto it = exact.find(l[i].key);
+    if (it == exact.end()) {
+      continue;
+    }
+    hit++;
+    double real = std::min(it->second, sat);
+    err += std::fabs(l[i].cnt - real) / real;
+  }
+
+  printf("%-10s %8.1f ns/sample  recall %.4f  relative error %.4f\n", name,
+         ns * 1.0 / trace.size(), hit * 1.0 / exact.size(),
+         hit ? err / hit : 0);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 5) {
+    printf("Usage: ./cm_bench top_k_file KeySpace(M) samples(M) zipfan\n");
+    exit(-1);
+  }
+
+  load_ground_truth(argv[1]);
+  uint64_t key_space = std::atoi(argv[2]) * MB;
+  uint64_t sample_cnt = std::atoi(argv[3]) * MB;
+  double zipfan = std::atof(argv[4]);
+
+  HotKeyTrace keys(key_space, sample_cnt, 0);
+  keys.zipfan = zipfan;
+  keys.generate(ZIPF, 1);
+
+  trace.reserve(sample_cnt);
+  for (auto k : keys.traces[0]) {
+    trace.push_back(make_key(k));
+    auto it = exact.find(trace.back());
+    if (it != exact.end()) {
+      it->second++;
+    }
+  }
+
+  int hot_cnt = exact.size();
+  printf("top %d keys, %lu samples\n", hot_cnt, sample_cnt);
+
+  run<BaselineCountMin>("baseline", hot_cnt, UINT32_MAX);
+  run<nap::CountMin>("CountMin", hot_cnt, 0xffff);
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include "hot_key_detector.h"
+#include "hotkey_trace.h"
+#include "timer.h"
+
+#include <fstream>
+
+// Replay a trace of ``generate_load`` through every hot-key detector and
+// report precision/recall of the reported top-k against exact counts, plus
+// the CPU cost per consumed sample.
+
+std::vector<std::string> trace; // sampled keys
+std::unordered_map<std::string, uint64_t> exact_top;
+
+void load_trace(const char *file_name, int sample_interval, int hot_cnt) {
+  std::ifstream file(file_name);
+  if (!file) {
+    printf("can not open %s\n", file_name);
+    exit(-1);
+  }
+
+  std::unordered_map<std::string, uint64_t> counter;
+  std::string line;
+  uint64_t op = 0;
+  while (std::getline(file, line)) {
+    auto pos = line.find(' ');
+    if (pos == std::string::npos) {
+      continue;
+    }
+    std::string key = line.substr(pos + 1);
+    counter[key]++;
+    if (op++ % sample_interval == 0) {
+      trace.push_back(key);
+    }
+  }
+
+  exact_top = exact_top_k(counter, hot_cnt);
+
+  printf("%lu ops, %lu keys, %lu samples\n", op, counter.size(),
+         trace.size());
+}
+
+template <class E> void run(const char *name, int hot_cnt) {
+  E detector(hot_cnt);
+
+  nap::Timer timer;
+  timer.begin();
+  for (auto &k : trace) {
+    detector.access_a_key(nap::Slice(k));
+  }
+  auto ns = timer.end();
+
+  uint64_t reported = 0;
+  uint64_t hit = hits(detector.get_list(), exact_top, &reported);
+
+  printf("%-14s %8.1f ns/sample  precision %.4f  recall %.4f\n", name,
+         ns * 1.0 / trace.size(), reported ? hit * 1.0 / reported : 0,
+         hit * 1.0 / exact_top.size());
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    printf("Usage: ./detector_bench trace_file hot_cnt sample_interval\n");
+    exit(-1);
+  }
+
+  int hot_cnt = std::atoi(argv[2]);
+  load_trace(argv[1], std::max(1, std::atoi(argv[3])), hot_cnt);
+
+  run<nap::CountMin>("count-min", hot_cnt);
+  run<nap::StreamSummary>("space-saving", hot_cnt);
+  run<nap::TinyLFU>("tiny-lfu", hot_cnt);
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "timer.h"
+#include "top_k.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_set>
+#include <vector>
+
+// CPU time of the shift thread to pick the next hot set and find its overlap
+// with the current one: sorting both and merging them, as switches did,
+// versus selecting the ordered prefix and looking keys up in the current
+// hot set's hash, as they do now.  Half of the next hot set is current.
+
+constexpr size_t kOrderedHotKeys = 1024; // as Nap::hot_list orders
+
+using NapPair = std::pair<std::string, int>;
+
+std::vector<nap::Node> heap; // a detector's list, slot 0 is the fence
+std::vector<NapPair> cur_list; // sorted by key
+std::unordered_set<std::string> cur_view;
+
+void gen(size_t hot_cnt) {
+  heap.push_back({"FENCE_KEY", 0});
+  for (size_t i = 0; i < hot_cnt; ++i) {
+    uint64_t k = i * 2654435761ull;
+    heap.push_back({std::string((char *)&k, sizeof(k)), rand() % 100000});
+
+    if (i % 2 != 0) { // hot now, but not in the next hot set
+      k = ~k;
+    }
+    std::string key((char *)&k, sizeof(k));
+    cur_list.push_back({key, 0});
+    cur_view.insert(key);
+  }
+  std::sort(cur_list.begin(), cur_list.end());
+}
+
+uint64_t sort_and_merge() {
+  auto l = heap;
+  std::sort(l.begin() + 1, l.end(), nap::hotter);
+
+  std::vector<NapPair> new_list;
+  for (size_t k = 1; k < l.size(); ++k) {
+    new_list.push_back({l[k].key, 0});
+  }
+  std::sort(new_list.begin(), new_list.end(),
+            [](const NapPair &a, const NapPair &b) {
+              return a.first < b.first;
+            });
+
+  uint64_t overlapped = 0;
+  for (size_t i = 0, j = 0; i < cur_list.size() && j < new_list.size();) {
+    int cmp = cur_list[i].first.compare(new_list[j].first);
+    if (cmp == 0) {
+      i++, j++;
+      overlapped++;
+    } else if (cmp < 0) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return overlapped;
+}
+
+uint64_t select_and_hash() {
+  auto l = heap;
+  nap::select_hottest(l, kOrderedHotKeys);
+
+  std::vector<NapPair> new_list;
+  for (size_t k = 1; k < l.size(); ++k) {
+    new_list.push_back({l[k].key, 0});
+  }
+
+  uint64_t overlapped = 0;
+  for (auto &p : new_list) {
+    if (cur_view.count(p.first)) {
+      overlapped++;
+    }
+  }
+  return overlapped;
+}
+
+template <class F> double run(F f, int rounds, uint64_t &overlapped) {
+  nap::Timer timer;
+  timer.begin();
+  for (int i = 0; i < rounds; ++i) {
+    overlapped = f();
+  }
+  return timer.end() / 1e6 / rounds;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage: ./hot_set_bench hot_cnt rounds\n");
+    exit(-1);
+  }
+
+  size_t hot_cnt = std::atoi(argv[1]);
+  int rounds = std::atoi(argv[2]);
+  gen(hot_cnt);
+
+  uint64_t a, b;
+  double sort_ms = run(sort_and_merge, rounds, a);
+  double select_ms = run(select_and_hash, rounds, b);
+  if (a != b) {
+    printf("overlap differs: %lu vs %lu\n", a, b);
+    exit(-1);
+  }
+
+  printf("%lu hot keys, %lu overlapped: sort and merge %.2f ms, select and "
+         "hash %.2f ms, saved %.2f ms per switch\n",
+         hot_cnt, a, sort_ms, select_ms, sort_ms - select_ms);
+  return 0;
+}
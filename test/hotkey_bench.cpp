@@ -0,0 +1,94 @@
+#include "hot_key_detector.h"
+#include "hotkey_trace.h"
+#include "timer.h"
+
+#include <atomic>
+#include <thread>
+
+// Accuracy of hot-key detection under different access patterns, sampling
+// intervals and thread counts.  Producers replay pre-generated traces into a
+// detector while the main thread polls and decays it as the shift thread
+// does.  For each run it reports
+//   recall@k:  fraction of the oracle top-k the detector reports
+//   hit loss:  accesses covered by the oracle top-k minus those covered by
+//              the reported keys, as a fraction of all accesses
+//   samples/s: samples consumed by the detector per second
+//   dropped:   fraction of samples lost because the consumer fell behind
+
+constexpr uint64_t MB = 1024ull * 1024;
+constexpr double kRoundSeconds = 0.05; // poll between two decays
+
+const char *detector_name[] = {"count-min", "space-saving", "tiny-lfu"};
+
+void run(const HotKeyTrace &trace, Workload w, nap::DetectorType type,
+         int thread_cnt, int interval) {
+  auto *detector = nap::new_detector(type, trace.hot_cnt);
+
+  std::atomic<int> finished{0};
+  std::vector<std::thread> producers;
+  nap::Timer timer;
+  timer.begin();
+  nap::Topology::reset();
+  for (int t = 0; t < thread_cnt; ++t) {
+    producers.emplace_back([&, t]() {
+      auto &keys = trace.traces[t];
+      for (uint64_t i = interval - 1; i < keys.size(); i += interval) {
+        detector->record(nap::Slice((char *)&keys[i], sizeof(uint64_t)),
+                         false);
+      }
+      finished.fetch_add(1);
+    });
+  }
+
+  while (finished.load() != thread_cnt) {
+    detector->decay();
+    detector->poll_workloads(kRoundSeconds);
+  }
+  detector->poll_workloads(kRoundSeconds); // drain the rings
+  double seconds = timer.end() / 1e9 - kRoundSeconds;
+
+  for (auto &th : producers) {
+    th.join();
+  }
+
+  uint64_t sampled = thread_cnt * (trace.ops_per_thread / interval);
+  uint64_t consumed = sampled - std::min(sampled, detector->dropped_samples());
+
+  double recall, hit_loss;
+  trace.score(detector->get_list(), recall, hit_loss);
+
+  printf("%-9s %-13s %3d threads  1/%-4d  recall@k %.4f  hit loss %.4f  "
+         "%7.2f M samples/s  dropped %.4f\n",
+         workload_name[w], detector_name[type], thread_cnt, interval, recall,
+         hit_loss, consumed / seconds / 1e6,
+         (sampled - consumed) * 1.0 / sampled);
+
+  delete detector;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4 && argc != 5) {
+    printf("Usage: ./hotkey_bench KeySpace(M) ops_per_thread(M) hot_cnt "
+           "[max_threads]\n");
+    exit(-1);
+  }
+
+  HotKeyTrace trace(std::atoi(argv[1]) * MB, std::atoi(argv[2]) * MB,
+                    std::atoi(argv[3]));
+  int max_threads = argc == 5 ? std::atoi(argv[4]) : 16;
+
+  const int intervals[] = {1, 8, 32};
+  for (int w = 0; w < WORKLOAD_CNT; ++w) {
+    for (int threads = 1; threads <= max_threads; threads *= 4) {
+      trace.generate((Workload)w, threads);
+      for (int interval : intervals) {
+        for (int type = nap::DETECTOR_COUNT_MIN; type <= nap::DETECTOR_TINY_LFU;
+             ++type) {
+          run(trace, (Workload)w, (nap::DetectorType)type, threads, interval);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+#if !defined(_HOTKEY_TRACE_H_)
+#define _HOTKEY_TRACE_H_
+
+#include "top_k.h"
+#include "zipf.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Key traces for the hot-key benchmarks, with the exact top-k of each trace
+// as the oracle a detector's list is scored against.
+
+constexpr double kHotFraction = 0.01; // hotspot: 1% of keys ...
+constexpr double kHotAccess = 0.9;    // ... receive 90% of accesses
+constexpr int kShiftPhases = 4;       // shifting-hotspot moves 3 times
+constexpr double kInsertRatio = 0.05; // latest: 5% of ops insert a key
+
+enum Workload { ZIPF, HOTSPOT, SHIFTING, LATEST, WORKLOAD_CNT };
+inline const char *workload_name[] = {"zipf", "hotspot", "shifting",
+                                      "latest"};
+
+// the ``k`` most accessed keys of ``counter``, with their counts
+template <class K>
+std::unordered_map<K, uint64_t>
+exact_top_k(const std::unordered_map<K, uint64_t> &counter, size_t k) {
+  std::vector<std::pair<K, uint64_t>> l(counter.begin(), counter.end());
+  auto top = std::min(k, l.size());
+  std::partial_sort(
+      l.begin(), l.begin() + top, l.end(),
+      [](const std::pair<K, uint64_t> &a, const std::pair<K, uint64_t> &b) {
+        return a.second > b.second;
+      });
+  return std::unordered_map<K, uint64_t>(l.begin(), l.begin() + top);
+}
+
+template <class K> K key_of(const nap::Node &n);
+template <> inline uint64_t key_of<uint64_t>(const nap::Node &n) {
+  return *(uint64_t *)n.key.c_str();
+}
+template <> inline std::string key_of<std::string>(const nap::Node &n) {
+  return n.key;
+}
+
+// entries of a detector's list ``l`` that are in ``top``; ``reported``, if
+// any, counts the entries with a count
+template <class M>
+uint64_t hits(const std::vector<nap::Node> &l, const M &top,
+              uint64_t *reported = nullptr) {
+  uint64_t res = 0;
+  for (size_t i = 1; i < l.size(); ++i) { // slot 0 is the fence
+    if (l[i].cnt == 0) {
+      continue;
+    }
+    if (reported) {
+      (*reported)++;
+    }
+    res += top.count(key_of<typename M::key_type>(l[i]));
+  }
+  return res;
+}
+
+struct HotKeyTrace {
+  uint64_t key_space;
+  uint64_t ops_per_thread;
+  size_t hot_cnt;
+  double zipfan = 0.99; // of zipf and latest
+
+  std::vector<std::vector<uint64_t>> traces; // per thread
+  std::unordered_map<uint64_t, uint64_t> exact;
+  std::unordered_map<uint64_t, uint64_t> oracle_top;
+  uint64_t all_access;
+  uint64_t oracle_access;
+
+  HotKeyTrace(uint64_t key_space, uint64_t ops_per_thread, size_t hot_cnt)
+      : key_space(key_space), ops_per_thread(ops_per_thread),
+        hot_cnt(hot_cnt) {}
+
+  void generate(Workload w, int thread_cnt) {
+    struct zipf_gen_state base;
+    double theta = w == HOTSPOT || w == SHIFTING ? 0 : zipfan; // 0: uniform
+    mehcached_zipf_init(&base, key_space, theta, 0);
+
+    std::vector<zipf_gen_state> state(thread_cnt);
+    for (int t = 0; t < thread_cnt; ++t) {
+      mehcached_zipf_init_copy(&state[t], &base, t * 12312312 + 1);
+    }
+
+    traces.assign(thread_cnt, std::vector<uint64_t>(ops_per_thread));
+    uint64_t hot_size = std::max<uint64_t>(1, key_space * kHotFraction);
+    uint64_t max_key = key_space;
+    for (uint64_t i = 0; i < ops_per_thread; ++i) {
+      for (int t = 0; t < thread_cnt; ++t) {
+        auto &s = state[t];
+        uint64_t k = mehcached_zipf_next(&s);
+        switch (w) {
+        case HOTSPOT:
+        case SHIFTING:
+          if (mehcached_rand_d(&s.rand_state) < kHotAccess) {
+            uint64_t phase =
+                w == SHIFTING ? i * kShiftPhases / ops_per_thread : 0;
+            k = phase * hot_size + k % hot_size;
+          }
+          break;
+        case LATEST:
+          if (mehcached_rand_d(&s.rand_state) < kInsertRatio) {
+            k = max_key++;
+          } else {
+            k = max_key - 1 - k;
+          }
+          break;
+        default:
+          break;
+        }
+        traces[t][i] = k;
+      }
+    }
+
+    // the oracle knows what is hot now: the last phase of a shifting hotspot
+    count(w == SHIFTING ? ops_per_thread / kShiftPhases * (kShiftPhases - 1)
+                        : 0);
+  }
+
+  // fraction of the oracle top-k that ``l`` reports, and the accesses the
+  // oracle top-k covers but ``l`` does not, as a fraction of all accesses
+  void score(const std::vector<nap::Node> &l, double &recall,
+             double &hit_loss) const {
+    uint64_t covered = 0;
+    for (size_t i = 1; i < l.size(); ++i) { // slot 0 is the fence
+      auto it = exact.find(key_of<uint64_t>(l[i]));
+      covered += it == exact.end() ? 0 : it->second;
+    }
+    recall = hits(l, oracle_top) * 1.0 / oracle_top.size();
+    hit_loss =
+        (oracle_access - std::min(oracle_access, covered)) * 1.0 / all_access;
+  }
+
+private:
+  void count(uint64_t begin) {
+    exact.clear();
+    all_access = 0;
+    for (auto &trace : traces) {
+      for (uint64_t i = begin; i < trace.size(); ++i) {
+        exact[trace[i]]++;
+        all_access++;
+      }
+    }
+
+    oracle_top = exact_top_k(exact, hot_cnt);
+    oracle_access = 0;
+    for (auto &p : oracle_top) {
+      oracle_access += p.second;
+    }
+  }
+};
+
+#endif // _HOTKEY_TRACE_H_
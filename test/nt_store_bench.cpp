@@ -0,0 +1,69 @@
+#include "nvm.h"
+#include "timer.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Persisting a CoW value by memcpy + clflushopt versus non-temporal stores,
+// by value size.  Each write goes 12B into a 4KB slot of the region, as a
+// value behind its CoW header, and slots are visited in a scattered order.
+
+constexpr size_t kRegionSize = 1024ull * 1024 * 1024;
+constexpr size_t kSlotSize = 4096;
+constexpr size_t kHeaderSize = 12;
+
+char *region;
+char src[kSlotSize];
+
+double run(size_t size, bool nt, uint64_t ops) {
+  const size_t slots = kRegionSize / kSlotSize;
+
+  nap::Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < ops; ++i) {
+    char *des = region + (i * 7919 % slots) * kSlotSize + kHeaderSize;
+    if (nt) {
+      persistent::nt_store_range(des, src, size);
+      persistent::persistent_barrier();
+    } else {
+      memcpy(des, src, size);
+      persistent::clflushopt_range(des, size);
+    }
+  }
+  return timer.end() * 1.0 / ops;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage: ./nt_store_bench dev_name ops(K)\n");
+    exit(-1);
+  }
+
+  uint64_t ops = std::atoi(argv[2]) * 1000ull;
+
+#ifndef DRAM
+  region = persistent::alloc_nvm(kRegionSize, argv[1]);
+#else
+  region = persistent::alloc_dram(kRegionSize);
+#endif
+  memset(region, 0, kRegionSize);
+  memset(src, 'a', sizeof(src));
+
+  printf("%6s %12s %12s %10s %10s\n", "size", "flush(ns)", "nt(ns)",
+         "flush GB/s", "nt GB/s");
+  for (size_t size = 16; size <= kSlotSize - kHeaderSize; size *= 2) {
+    double flush_ns = run(size, false, ops);
+    double nt_ns = run(size, true, ops);
+    printf("%6lu %12.1f %12.1f %10.3f %10.3f\n", size, flush_ns, nt_ns,
+           size / flush_ns, size / nt_ns);
+  }
+
+  size_t threshold = persistent::calibrate_nt_store(region, 1024 * 1024);
+  if (threshold == (size_t)-1) {
+    printf("calibration: always copy and flush\n");
+  } else {
+    printf("calibration: non-temporal stores from %lu bytes\n", threshold);
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include "rw_lock.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+// NumaRWLock readers on helper ids (committers, warmers) and on worker ids
+// at the same time: releasing one must not release the other, or a writer
+// would get in while the other reader is still inside.
+
+constexpr int kWaitUs = 1000; // for a wrongly admitted writer to show up
+
+// whether a writer got in while ``worker`` still held the lock after
+// ``helper`` released it
+bool writer_overtakes(nap::NumaRWLock &lock, int helper, int worker) {
+  lock.read_lock(helper);
+  lock.read_lock(worker);
+  lock.read_unlock(helper);
+
+  std::atomic<bool> locked{false};
+  std::thread writer([&]() {
+    lock.write_lock();
+    locked.store(true);
+    lock.write_unlock();
+  });
+
+  usleep(kWaitUs);
+  bool overtaken = locked.load();
+  lock.read_unlock(worker);
+  writer.join();
+  return overtaken;
+}
+
+int main() {
+  auto *lock = new nap::NumaRWLock;
+
+  int failed = 0;
+  for (int n = 0; n < nap::Topology::kNumaCnt; ++n) {
+    for (int helper : {nap::Topology::committerID(n),
+                       nap::Topology::warmerID(n)}) {
+      for (int worker = 0; worker < nap::Topology::kReservedIDBegin;
+           ++worker) {
+        if (writer_overtakes(*lock, helper, worker)) {
+          printf("helper %d released the read lock of worker %d\n", helper,
+                 worker);
+          failed++;
+        }
+      }
+    }
+  }
+
+  delete lock;
+  printf("%s\n", failed ? "FAILED" : "OK");
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,82 @@
+#include "rw_lock.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Writer acquisition latency of the switch locks under read-mostly load:
+// ``reader_threads`` threads take the read lock around every operation, as
+// put/del do with data_race_lock, while one writer takes the write lock
+// every millisecond, as the shift thread does once per switch.
+
+constexpr int kWriterPeriodUs = 1000;
+
+template <class L> void run(const char *name, int reader_threads, int seconds) {
+  auto *lock = new L;
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> reads{0};
+
+  nap::Topology::reset(); // id 0 is the writer, as for the shift thread
+  std::vector<std::thread> readers;
+  for (int t = 0; t < reader_threads; ++t) {
+    readers.emplace_back([&]() {
+      nap::Topology::threadID();
+      uint64_t cnt = 0;
+      while (running.load(std::memory_order_relaxed)) {
+        lock->read_lock();
+        cnt++;
+        lock->read_unlock();
+      }
+      reads.fetch_add(cnt);
+    });
+  }
+
+  std::vector<uint64_t> latency; // ns
+  nap::Timer total, timer;
+  total.begin();
+  while (total.end() < seconds * 1e9) {
+    usleep(kWriterPeriodUs);
+    timer.begin();
+    lock->write_lock();
+    latency.push_back(timer.end());
+    lock->write_unlock();
+  }
+  running.store(false);
+  double elapsed = total.end() / 1e9;
+  for (auto &th : readers) {
+    th.join();
+  }
+
+  std::sort(latency.begin(), latency.end());
+  uint64_t sum = 0;
+  for (auto l : latency) {
+    sum += l;
+  }
+  printf("%-18s %2d readers  write_lock avg %8.1f us  p50 %8.1f us  "
+         "p99 %8.1f us  max %8.1f us  reads %6.2f Mops\n",
+         name, reader_threads, sum / 1000.0 / latency.size(),
+         latency[latency.size() / 2] / 1000.0,
+         latency[latency.size() * 99 / 100] / 1000.0,
+         latency.back() / 1000.0, reads.load() / 1e6 / elapsed);
+
+  delete lock;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage: ./rwlock_bench reader_threads seconds\n");
+    exit(-1);
+  }
+
+  int reader_threads =
+      std::min(std::atoi(argv[1]), nap::kMaxThreadCnt - 1);
+  int seconds = std::atoi(argv[2]);
+
+  run<nap::ReadFirendlyLock>("ReadFirendlyLock", reader_threads, seconds);
+  run<nap::NumaRWLock>("NumaRWLock", reader_threads, seconds);
+
+  return 0;
+}
@@ -1,4 +1,4 @@
-#include "count_min_sketch.h"
+#include "hot_key_detector.h"
 
 #include <algorithm>
 #include <thread>
@@ -7,7 +7,7 @@
 
 #define kKeySpace (1024ull * 1024 * 1024)
 
-nap::CountMin *CM;
+nap::HotKeyDetector *CM;
 
 constexpr int kAccessThread = 16;
 void access_thread(int i) {
@@ -27,7 +27,7 @@ void access_thread(int i) {
     uint64_t k = mehcached_zipf_next(&state) + center;
     nap::Timer::sleep(1000);
     if (count++ % 10 == 0) {
-      CM->record(nap::Slice((char *)(&k), sizeof(uint64_t)));
+      CM->record(nap::Slice((char *)(&k), sizeof(uint64_t)), false);
 
       if (timer.end() > (1000ull * 1000 * 1000 * 10)) {
         timer.begin();
@@ -65,7 +65,7 @@ void background_thread() {
 
 int main() {
 
-  CM = new nap::CountMin(100000);
+  CM = nap::new_detector(nap::DETECTOR_COUNT_MIN, 100000);
 
   for (int i = 0; i < kAccessThread; ++i) {
     new std::thread(access_thread, i);
@@ -0,0 +1,55 @@
+#include "count_min_sketch.h"
+#include "hotkey_trace.h"
+#include "stream_summary.h"
+#include "timer.h"
+
+// Compare the min heap (fed by count-min sketch) with Space-Saving on a
+// zipfan trace: time per sample and recall of the exact top-k.
+
+constexpr uint64_t MB = 1024ull * 1024;
+
+template <class F, class G>
+void run(const HotKeyTrace &trace, const char *name, F access, G get_list) {
+  auto &keys = trace.traces[0];
+  nap::Timer timer;
+  timer.begin();
+  for (auto k : keys) {
+    access(nap::Slice((char *)&k, sizeof(uint64_t)));
+  }
+  auto ns = timer.end();
+
+  printf("%-16s %8.1f ns/sample  %8.2f M samples/s  recall %.4f\n", name,
+         ns * 1.0 / keys.size(), keys.size() * 1000.0 / ns,
+         hits(get_list(), trace.oracle_top) * 1.0 / trace.oracle_top.size());
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 5) {
+    printf("Usage: ./topk_bench KeySpace(M) samples(M) hot_cnt zipfan\n");
+    exit(-1);
+  }
+
+  int hot_cnt = std::atoi(argv[3]);
+  HotKeyTrace trace(std::atoi(argv[1]) * MB, std::atoi(argv[2]) * MB,
+                    hot_cnt);
+  trace.zipfan = std::atof(argv[4]);
+  trace.generate(ZIPF, 1);
+
+  // count-min sketch + min heap (+ unordered_map)
+  {
+    nap::CountMin CM(hot_cnt);
+    run(trace, "cm+heap",
+        [&](const nap::Slice &key) { CM.access_a_key(key); },
+        [&]() -> std::vector<nap::Node> & { return CM.get_list(); });
+  }
+
+  // stream-summary
+  {
+    nap::StreamSummary ss(hot_cnt);
+    run(trace, "space-saving",
+        [&](const nap::Slice &key) { ss.access_a_key(key); },
+        [&]() -> std::vector<nap::Node> & { return ss.get_list(); });
+  }
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "nap_meta.h"
+#include "zipf.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Media write amplification of PC-View slot placements on emulated Optane:
+// each node has an XPBuffer of ``buffer_lines`` 256B XPLines (LRU); a slot
+// update that misses it costs a 256B read, and every evicted line a 256B
+// media write.  Key k is written from node ``k % kNumaCnt`` with
+// probability ``affinity``, otherwise from a random node.
+
+constexpr uint64_t MB = 1024ull * 1024;
+constexpr int kNumaCnt = nap::Topology::kNumaCnt;
+constexpr int kSlotPerXPLine = nap::kXPLineSize / nap::kCachelineSize;
+
+struct XPBuffer {
+  size_t capacity;
+  std::list<uint64_t> lru;
+  std::unordered_map<uint64_t, std::list<uint64_t>::iterator> lines;
+  uint64_t media_read = 0, media_write = 0; // in XPLines
+
+  void write(uint64_t line) {
+    auto it = lines.find(line);
+    if (it != lines.end()) { // combined in the buffer
+      lru.splice(lru.begin(), lru, it->second);
+      return;
+    }
+
+    media_read++; // read-modify-write
+    if (lines.size() == capacity) {
+      lines.erase(lru.back());
+      lru.pop_back();
+      media_write++;
+    }
+    lru.push_front(line);
+    lines[line] = lru.begin();
+  }
+
+  void flush() {
+    media_write += lines.size();
+    lines.clear();
+    lru.clear();
+  }
+};
+
+struct Write {
+  uint32_t key;
+  uint8_t node;
+};
+
+std::vector<Write> trace;
+
+void run(const char *name, std::vector<nap::NapPair> &list, int buffer_lines) {
+  std::unordered_map<uint32_t, uint64_t> slot_of;
+  for (size_t i = 0; i < list.size(); ++i) {
+    slot_of[std::stoul(list[i].first)] = i;
+  }
+
+  XPBuffer buffer[kNumaCnt];
+  for (auto &b : buffer) {
+    b.capacity = buffer_lines;
+  }
+  for (auto &w : trace) {
+    buffer[w.node].write(slot_of[w.key] / kSlotPerXPLine);
+  }
+
+  uint64_t media_read = 0, media_write = 0;
+  for (auto &b : buffer) {
+    b.flush();
+    media_read += b.media_read;
+    media_write += b.media_write;
+  }
+
+  double host = trace.size() * 1.0 * nap::kCachelineSize;
+  printf("%-8s media write %8.2f MB  media read %8.2f MB  "
+         "write amplification %.3f\n",
+         name, media_write * nap::kXPLineSize / 1.0 / MB,
+         media_read * nap::kXPLineSize / 1.0 / MB,
+         media_write * nap::kXPLineSize / host);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 6) {
+    printf("Usage: ./xpline_bench hot_cnt writes(M) zipfan affinity "
+           "buffer_lines\n");
+    exit(-1);
+  }
+
+  int hot_cnt = std::atoi(argv[1]);
+  uint64_t write_cnt = std::atoi(argv[2]) * MB;
+  double zipfan = std::atof(argv[3]);
+  double affinity = std::atof(argv[4]);
+  int buffer_lines = std::atoi(argv[5]);
+
+  struct zipf_gen_state state;
+  mehcached_zipf_init(&state, hot_cnt, zipfan, 0);
+
+  std::vector<int> cnt(hot_cnt);
+  trace.resize(write_cnt);
+  for (auto &w : trace) {
+    w.key = mehcached_zipf_next(&state);
+    w.node = w.key % kNumaCnt;
+    if (mehcached_rand_d(&state.rand_state) >= affinity) {
+      w.node = (uint64_t)(mehcached_rand_d(&state.rand_state) * kNumaCnt) %
+               kNumaCnt;
+    }
+    cnt[w.key]++;
+  }
+
+  std::vector<nap::NapPair> list;
+  nap::SlotHeatMap heat;
+  for (int k = 0; k < hot_cnt; ++k) {
+    auto key = std::to_string(k);
+    list.push_back({key, nap::WhereIsData::IN_RAW_INDEX});
+    heat[key] = {k % kNumaCnt, cnt[k]};
+  }
+
+  printf("%d hot keys, %lu writes, %.2f of them from the key's node\n",
+         hot_cnt, write_cnt, affinity);
+
+  std::random_shuffle(list.begin(), list.end());
+  run("random", list, buffer_lines);
+
+  nap::place_by_write_heat(list.begin(), list.end(), heat);
+  run("xpline", list, buffer_lines);
+
+  return 0;
+}